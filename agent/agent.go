@@ -23,12 +23,18 @@ import (
 	"github.com/subutai-io/agent/agent/container"
 	"github.com/subutai-io/agent/agent/discovery"
 	"github.com/subutai-io/agent/agent/executer"
+	"github.com/subutai-io/agent/agent/health"
 	"github.com/subutai-io/agent/agent/logger"
 	"github.com/subutai-io/agent/agent/monitor"
 	"github.com/subutai-io/agent/agent/utils"
 	"github.com/subutai-io/agent/config"
+	"github.com/subutai-io/agent/db"
 	"github.com/subutai-io/agent/lib/gpg"
+	"github.com/subutai-io/agent/lib/nginx"
 	"github.com/subutai-io/agent/log"
+
+	cont "github.com/subutai-io/agent/lib/container"
+	ovs "github.com/subutai-io/agent/lib/net"
 )
 
 //Response covers heartbeat date because of format required by Management server.
@@ -49,6 +55,7 @@ type heartbeat struct {
 }
 
 var (
+	restore           = make(chan bool, 1)
 	lastHeartbeat     []byte
 	mutex             sync.Mutex
 	fingerprint       string
@@ -73,16 +80,26 @@ func initAgent() {
 //Start starting Subutai Agent daemon, all required goroutines and keep working during all life cycle.
 func Start() {
 	initAgent()
+	log.Check(log.WarnLevel, "Serving database", db.Serve(&nginx.Reloader{}, &ovs.Wan{}, &discovery.Peers{}))
 
 	http.HandleFunc("/trigger", trigger)
 	http.HandleFunc("/ping", ping)
 	http.HandleFunc("/heartbeat", heartbeatCall)
+	http.HandleFunc("/templates/", discovery.ServeTemplates)
 	go http.ListenAndServe(":7070", nil)
 
+	go cont.Monitor(stateChanged)
 	go discovery.Monitor()
+	go discovery.Templates()
 	go monitor.Collect()
+	go restoreStates()
 	go connectionMonitor()
+	go poolRefill()
+	go gpg.KeyPool()
 	go alert.Processing()
+	go health.Check()
+	go ovs.OVSMonitor()
+	go ovs.WatchIp()
 	go logger.SyslogServer()
 
 	go func() {
@@ -105,6 +122,29 @@ func Start() {
 	}
 }
 
+// poolRefill periodically recreates standby clones taken from the warm pools.
+// Clones are prepared with the idle I/O scheduling class and the lowest CPU priority to not affect running containers.
+func poolRefill() {
+	for {
+		err := exec.Command("ionice", "-c", "3", "nice", "-n", "19", "subutai", "pool", "-r").Run()
+		log.Check(log.DebugLevel, "Refilling warm pools", err)
+		time.Sleep(time.Minute)
+	}
+}
+
+// stateChanged reacts on container state transitions: Management server gets updated heartbeat
+// and desired container states are restored without waiting for the next polling cycle.
+func stateChanged(name, state string) {
+	log.Debug("Container " + name + " changed state to " + state)
+	switch state {
+	case "STARTING", "STOPPING", "FREEZING":
+		return
+	}
+	restoreRequest()
+	lastHeartbeat = []byte{}
+	go sendHeartbeat()
+}
+
 func checkSS() (status bool) {
 	resp, err := client.Get("https://" + config.Management.Host + ":8443/rest/v1/peer/inited")
 	if err == nil {
@@ -116,9 +156,26 @@ func checkSS() (status bool) {
 	return false
 }
 
+// restoreRequest asks restoreStates for a run, requests made while one is pending are merged.
+func restoreRequest() {
+	select {
+	case restore <- true:
+	default:
+	}
+}
+
+// restoreStates restores desired container states on request, one run at a time and at least 10 seconds apart,
+// so containers failing to start use up their attempts with the same spacing regardless of how often their state changes.
+func restoreStates() {
+	for range restore {
+		container.StateRestore()
+		time.Sleep(10 * time.Second)
+	}
+}
+
 func connectionMonitor() {
 	for {
-		container.StateRestore()
+		restoreRequest()
 		if !checkSS() {
 			time.Sleep(time.Second * 10)
 			continue
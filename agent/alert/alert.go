@@ -295,3 +295,12 @@ func Quota(list []container.Container) (output []container.Container) {
 	}
 	return
 }
+
+// Usage returns CPU and RAM usage of the container in percents of its quota sampled by Processing.
+func Usage(name string) (cpu, ram int, ok bool) {
+	load, ok := stats[name]
+	if !ok || load.CPU == nil || load.RAM == nil {
+		return 0, 0, false
+	}
+	return load.CPU.Current, load.RAM.Current, true
+}
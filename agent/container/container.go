@@ -14,8 +14,6 @@ import (
 
 	cont "github.com/subutai-io/agent/lib/container"
 	"github.com/subutai-io/agent/lib/gpg"
-
-	lxc "gopkg.in/lxc/go-lxc.v2"
 )
 
 // Container describes Subutai container with all required options for the Management server.
@@ -78,7 +76,9 @@ func parsePasswd(path, name string) (uid string, gid string) {
 func Active(details bool) []Container {
 	contArr := []Container{}
 
-	for _, c := range cont.Containers() {
+	list := cont.Containers()
+	states := cont.States(list)
+	for _, c := range list {
 		hostname, err := ioutil.ReadFile(config.Agent.LxcPrefix + c + "/rootfs/etc/hostname")
 		if err != nil {
 			continue
@@ -89,7 +89,7 @@ func Active(details bool) []Container {
 			ID:         gpg.GetFingerprint(c),
 			Name:       c,
 			Hostname:   strings.TrimSpace(string(hostname)),
-			Status:     cont.State(c),
+			Status:     states[c],
 			Arch:       strings.ToUpper(cont.GetConfigItem(configpath, "lxc.arch")),
 			Interfaces: interfaces(c),
 			Parent:     cont.GetConfigItem(configpath, "subutai.parent"),
@@ -106,10 +106,11 @@ func Active(details bool) []Container {
 func interfaces(name string) []utils.Iface {
 	iface := new(utils.Iface)
 
-	c, err := lxc.NewContainer(name, config.Agent.LxcPrefix)
+	c, err := cont.Acquire(name)
 	if err != nil {
 		return []utils.Iface{*iface}
 	}
+	defer cont.Release(c)
 
 	iface.InterfaceName = "eth0"
 	listip, err := c.IPAddress(iface.InterfaceName)
@@ -3,13 +3,15 @@ package container
 import (
 	"os"
 	"os/exec"
+	"sync"
 
 	"github.com/subutai-io/agent/config"
 	"github.com/subutai-io/agent/log"
 )
 
 var (
-	contsStatus map[string]int
+	contsStatus  map[string]int
+	restoreMutex sync.Mutex
 )
 
 func init() {
@@ -18,6 +20,9 @@ func init() {
 
 // StateRestore checks container state and starting or stopping containers if required.
 func StateRestore() {
+	restoreMutex.Lock()
+	defer restoreMutex.Unlock()
+
 	for _, cont := range Active(false) {
 		var start, stop bool
 
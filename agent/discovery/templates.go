@@ -0,0 +1,147 @@
+package discovery
+
+import (
+	"net"
+	"net/http"
+	"os"
+	"strings"
+	"sync"
+	"time"
+
+	"github.com/fromkeith/gossdp"
+	"github.com/subutai-io/agent/config"
+	ovs "github.com/subutai-io/agent/lib/net"
+	"github.com/subutai-io/agent/lib/template"
+	"github.com/subutai-io/agent/log"
+)
+
+var (
+	// peers maps template cache locations of other resource hosts to the time they expire
+	peers   = make(map[string]time.Time)
+	peersMu sync.Mutex
+)
+
+// Peers exposes template caches found in the local network to the commands.
+type Peers struct{}
+
+// List returns locations of template caches of other resource hosts, archives are requested by appending their hash sum.
+func (p *Peers) List(_ bool, list *[]string) error {
+	peersMu.Lock()
+	defer peersMu.Unlock()
+	for location, expire := range peers {
+		if time.Now().After(expire) {
+			delete(peers, location)
+			continue
+		}
+		*list = append(*list, location)
+	}
+	return nil
+}
+
+type peersHandler struct {
+	handler
+}
+
+func (h peersHandler) Response(message gossdp.ResponseMessage) {
+	if message.SearchType != templatesUrn() || message.Location == location() {
+		return
+	}
+	age := message.MaxAge
+	if age <= 0 {
+		age = 300
+	}
+	peersMu.Lock()
+	peers[message.Location] = time.Now().Add(time.Duration(age) * time.Second)
+	peersMu.Unlock()
+}
+
+// Templates looks for template caches of other resource hosts in the local network,
+// and advertises the cache of this host if share option of [cdn] section is enabled.
+func Templates() {
+	if config.CDN.Share {
+		go share()
+	}
+	for {
+		log.Check(log.DebugLevel, "Searching template peers", search())
+		time.Sleep(60 * time.Second)
+	}
+}
+
+// ServeTemplates sends the archive of template with hash sum from the request path, if it's indexed in tmpdir as shared.
+// Only public templates downloaded from the repository are shared and only to the hosts in the local networks,
+// as the requests are not authenticated. Range requests are supported.
+func ServeTemplates(w http.ResponseWriter, r *http.Request) {
+	sum := strings.TrimPrefix(r.URL.Path, "/templates/")
+	if !config.CDN.Share || len(sum) == 0 || strings.Contains(sum, "/") || !local(r.RemoteAddr) {
+		http.NotFound(w, r)
+		return
+	}
+	file := template.CacheShared(sum)
+	if len(file) == 0 {
+		http.NotFound(w, r)
+		return
+	}
+	http.ServeFile(w, r, config.Agent.LxcPrefix+"tmpdir/"+file)
+}
+
+// local returns true if the address belongs to a network the host is directly connected to.
+func local(addr string) bool {
+	host, _, err := net.SplitHostPort(addr)
+	if err != nil {
+		return false
+	}
+	ip := net.ParseIP(host)
+	addrs, err := net.InterfaceAddrs()
+	if ip == nil || err != nil {
+		return false
+	}
+	for _, a := range addrs {
+		if n, ok := a.(*net.IPNet); ok && n.Contains(ip) {
+			return true
+		}
+	}
+	return false
+}
+
+// share advertises the cache, restarting the advertisement when the host address changes.
+func share() {
+	for {
+		addr := location()
+		s, err := gossdp.NewSsdpWithLogger(nil, handler{})
+		if log.Check(log.WarnLevel, "Starting template cache advertisement", err) {
+			time.Sleep(30 * time.Second)
+			continue
+		}
+		go s.Start()
+		s.AdvertiseServer(gossdp.AdvertisableServer{
+			ServiceType: templatesUrn(),
+			DeviceUuid:  ovs.GetIp(),
+			Location:    addr,
+			MaxAge:      300,
+		})
+		for addr == location() {
+			time.Sleep(30 * time.Second)
+		}
+		s.Stop()
+	}
+}
+
+func search() error {
+	c, err := gossdp.NewSsdpClientWithLogger(peersHandler{}, handler{})
+	if err == nil {
+		go c.Start()
+		defer c.Stop()
+
+		err = c.ListenFor(templatesUrn())
+		time.Sleep(2 * time.Second)
+	}
+	return err
+}
+
+func templatesUrn() string {
+	return "urn:" + os.Getenv("SNAP_NAME") + ":templates:peer:1"
+}
+
+func location() string {
+	return "http://" + ovs.GetIp() + ":7070/templates/"
+}
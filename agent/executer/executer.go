@@ -17,8 +17,9 @@ import (
 	"gopkg.in/lxc/go-lxc.v2"
 
 	"github.com/subutai-io/agent/agent/container"
-	"github.com/subutai-io/agent/config"
 	"github.com/subutai-io/agent/log"
+
+	cont "github.com/subutai-io/agent/lib/container"
 )
 
 // EncRequest describes encrypted JSON request from Management server.
@@ -228,10 +229,11 @@ func genericResponse(req RequestOptions) ResponseOptions {
 // AttachContainer executes request inside Container host
 // and sends output as response.
 func AttachContainer(name string, req RequestOptions, outCh chan<- ResponseOptions) error {
-	c, err := lxc.NewContainer(name, config.Agent.LxcPrefix)
+	c, err := cont.Acquire(name)
 	if err != nil {
 		return err
 	}
+	defer cont.Release(c)
 
 	rop, wop, err := os.Pipe()
 	if err != nil {
@@ -289,7 +291,6 @@ func AttachContainer(name string, req RequestOptions, outCh chan<- ResponseOptio
 		response.ExitCode = strconv.Itoa(exitCode / 256)
 	}
 	outCh <- response
-	lxc.Release(c)
 	close(outCh)
 	return nil
 }
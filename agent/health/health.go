@@ -0,0 +1,316 @@
+// Package health checks backends of reverse proxy domains and port mappings, takes failing nodes out of rotation
+// and weights healthy nodes by the load of their containers.
+package health
+
+import (
+	"errors"
+	"net"
+	"net/http"
+	"strconv"
+	"strings"
+	"sync"
+	"time"
+
+	"github.com/influxdata/influxdb/client/v2"
+
+	"github.com/subutai-io/agent/agent/alert"
+	"github.com/subutai-io/agent/config"
+	"github.com/subutai-io/agent/db"
+	"github.com/subutai-io/agent/lib/nginx"
+	"github.com/subutai-io/agent/log"
+)
+
+const (
+	interval = 10 * time.Second
+	timeout  = 2 * time.Second
+	// fall is the number of failed probes taking node out of rotation, rise is the number of passed probes returning it back
+	fall = 3
+	rise = 2
+	// maxWeight is the weight of idle node when load weighting is enabled
+	maxWeight = 5
+	// margin is the load, in percents, by which the node should get past the bounds of its weight to change it,
+	// smoothing is the share of the latest sample in the averaged load. Both keep weights from flapping,
+	// since every weight change reloads nginx.
+	margin    = 10
+	smoothing = 0.3
+)
+
+// node keeps probe history of the backend.
+type node struct {
+	fails, passes int
+	load          float64
+	state         db.Backend
+}
+
+// result is the outcome of single probe.
+type result struct {
+	addr    string
+	kind    string
+	latency time.Duration
+	err     error
+}
+
+var (
+	nodes    = make(map[string]*node)
+	dbclient client.Client
+)
+
+// Check works as a daemon, probing backends of domains and port mappings. TCP backends are probed with connect,
+// HTTP backends with a request, UDP backends are not checked. Changed states are stored in the database
+// and configs of affected upstreams are rendered again, probe latency and errors are sent to InfluxDB.
+func Check() {
+	bolt, err := db.New()
+	if !log.Check(log.WarnLevel, "Opening database", err) {
+		for addr, state := range bolt.Backends() {
+			nodes[addr] = &node{state: state}
+		}
+		log.Check(log.WarnLevel, "Closing database", bolt.Close())
+	}
+	for {
+		time.Sleep(interval)
+		check()
+	}
+}
+
+func check() {
+	bolt, err := db.New()
+	if log.Check(log.WarnLevel, "Opening database", err) {
+		return
+	}
+	mappings := bolt.PortMappings()
+	proxies := bolt.Proxies()
+	log.Check(log.WarnLevel, "Closing database", bolt.Close())
+
+	targets := make(map[string]string)
+	for _, p := range proxies {
+		for _, addr := range p.Nodes {
+			targets[addr] = "http"
+		}
+	}
+	for _, m := range mappings {
+		for _, addr := range m.Nodes {
+			switch m.Protocol {
+			case "http", "https":
+				targets[addr] = "http"
+			case "tcp":
+				targets[addr] = "tcp"
+			}
+		}
+	}
+
+	results := make(chan result, len(targets))
+	var wg sync.WaitGroup
+	for addr, kind := range targets {
+		wg.Add(1)
+		go func(addr, kind string) {
+			defer wg.Done()
+			start := time.Now()
+			results <- result{addr: addr, kind: kind, err: probe(addr, kind), latency: time.Since(start)}
+		}(addr, kind)
+	}
+	wg.Wait()
+	close(results)
+
+	changed := make(map[string]bool)
+	var list []result
+	for r := range results {
+		list = append(list, r)
+		n, ok := nodes[r.addr]
+		if !ok {
+			n = &node{}
+			nodes[r.addr] = n
+		}
+		state := n.update(r.err)
+		if config.Agent.LoadWeights && !state.Down {
+			state.Weight = n.weight(r.addr)
+		} else {
+			state.Weight = 0
+		}
+		if state != n.state {
+			log.Debug("Backend " + r.addr + " state changed, down: " + strconv.FormatBool(state.Down) + ", weight: " + strconv.Itoa(state.Weight))
+			n.state = state
+			changed[r.addr] = true
+		}
+	}
+	for addr := range nodes {
+		if _, ok := targets[addr]; !ok {
+			delete(nodes, addr)
+			changed[addr] = true
+		}
+	}
+	metrics(list)
+
+	if len(changed) != 0 {
+		apply(changed, mappings, proxies)
+	}
+}
+
+// update counts the probe result and returns new state of the node.
+func (n *node) update(err error) db.Backend {
+	state := n.state
+	if err != nil {
+		n.passes = 0
+		if n.fails++; n.fails >= fall {
+			state.Down = true
+		}
+	} else {
+		n.fails = 0
+		if n.passes++; n.passes >= rise || !state.Down {
+			state.Down = false
+		}
+	}
+	return state
+}
+
+// probe checks that backend accepts connections. HTTP backend should respond with any status below 500.
+func probe(addr, kind string) error {
+	if kind == "http" {
+		if !strings.Contains(addr, ":") {
+			addr += ":80"
+		}
+		c := http.Client{Timeout: timeout}
+		resp, err := c.Get("http://" + addr + "/")
+		if err != nil {
+			return err
+		}
+		resp.Body.Close()
+		if resp.StatusCode >= 500 {
+			return errors.New(resp.Status)
+		}
+		return nil
+	}
+	conn, err := net.DialTimeout("tcp", addr, timeout)
+	if err == nil {
+		conn.Close()
+	}
+	return err
+}
+
+// weight returns upstream weight of the node from averaged CPU and RAM usage of its container, idle node gets maxWeight.
+// Current weight is kept until the load gets past its bounds by margin.
+func (n *node) weight(addr string) int {
+	load, ok := usage(addr)
+	if !ok {
+		return 0
+	}
+	if n.state.Weight == 0 {
+		n.load = float64(load)
+	} else {
+		n.load += smoothing * (float64(load) - n.load)
+	}
+	w := loadWeight(int(n.load))
+	if n.state.Weight != 0 && w != n.state.Weight &&
+		(loadWeight(int(n.load)-margin) == n.state.Weight || loadWeight(int(n.load)+margin) == n.state.Weight) {
+		return n.state.Weight
+	}
+	return w
+}
+
+// loadWeight converts load in percents to upstream weight.
+func loadWeight(load int) int {
+	if load < 0 {
+		load = 0
+	} else if load > 100 {
+		load = 100
+	}
+	return maxWeight - load*(maxWeight-1)/100
+}
+
+// usage returns load of the container of the node in percents, the higher of CPU and RAM usage.
+func usage(addr string) (int, bool) {
+	bolt, err := db.New()
+	if err != nil {
+		return 0, false
+	}
+	list := bolt.ContainerByKey("ip", strings.Split(addr, ":")[0])
+	bolt.Close()
+	if len(list) == 0 {
+		return 0, false
+	}
+	cpu, ram, ok := alert.Usage(list[0])
+	if !ok {
+		return 0, false
+	}
+	if ram > cpu {
+		return ram, true
+	}
+	return cpu, true
+}
+
+// apply stores changed states and renders configs of the upstreams having changed nodes.
+// Upstreams are read again before rendering, so changes made by commands during the probes are not lost.
+func apply(changed map[string]bool, mappings []db.Mapping, proxies []db.Proxy) {
+	bolt, err := db.New()
+	if log.Check(log.WarnLevel, "Opening database", err) {
+		return
+	}
+	defer bolt.Close()
+	for addr := range changed {
+		var state db.Backend
+		if n, ok := nodes[addr]; ok {
+			state = n.state
+		}
+		log.Check(log.WarnLevel, "Saving backend state", bolt.BackendSet(addr, state))
+	}
+
+	for _, m := range mappings {
+		if affected(m.Nodes, changed) {
+			log.Check(log.WarnLevel, "Writing port map config", nginx.WriteMap(bolt.PortMapping(m.Protocol, m.External)))
+		}
+	}
+	for _, p := range proxies {
+		if affected(p.Nodes, changed) {
+			log.Check(log.WarnLevel, "Writing proxy config", nginx.WriteProxy(bolt.ProxyGet(p.Vlan)))
+		}
+	}
+	log.Check(log.WarnLevel, "Reloading nginx", nginx.Reload())
+}
+
+func affected(list []string, changed map[string]bool) bool {
+	for _, addr := range list {
+		if changed[addr] {
+			return true
+		}
+	}
+	return false
+}
+
+// metrics sends probe latency and errors of the backends to InfluxDB.
+func metrics(list []result) {
+	if len(list) == 0 {
+		return
+	}
+	if dbclient == nil {
+		var err error
+		dbclient, err = client.NewHTTPClient(client.HTTPConfig{
+			Addr:               "https://" + config.Influxdb.Server + ":8086",
+			Username:           config.Influxdb.User,
+			Password:           config.Influxdb.Pass,
+			InsecureSkipVerify: true,
+		})
+		if log.Check(log.DebugLevel, "Creating InfluxDB client", err) {
+			dbclient = nil
+			return
+		}
+	}
+	bp, err := client.NewBatchPoints(client.BatchPointsConfig{Database: config.Influxdb.Db, RetentionPolicy: "hour"})
+	if err != nil {
+		return
+	}
+	for _, r := range list {
+		failed := 0
+		if r.err != nil {
+			failed = 1
+		}
+		point, err := client.NewPoint("backend",
+			map[string]string{"node": r.addr, "type": r.kind},
+			map[string]interface{}{"latency": r.latency.Seconds() * 1000, "error": failed},
+			time.Now())
+		if err == nil {
+			bp.AddPoint(point)
+		}
+	}
+	if log.Check(log.DebugLevel, "Writing backend metrics", dbclient.Write(bp)) {
+		dbclient = nil
+	}
+}
@@ -4,7 +4,7 @@
 package cli
 
 import (
-	"github.com/subutai-io/agent/config"
+	"github.com/subutai-io/agent/lib/container"
 	"github.com/subutai-io/agent/log"
 	"gopkg.in/lxc/go-lxc.v2"
 )
@@ -14,8 +14,9 @@ import (
 // `name` should be available running Subutai container,
 // otherwise command will return error message and non-zero exit code.
 func LxcAttach(name string, cmd []string) {
-	c, err := lxc.NewContainer(name, config.Agent.LxcPrefix)
+	c, err := container.Acquire(name)
 	log.Check(log.ErrorLevel, "Creating container object", err)
+	defer container.Release(c)
 
 	options := lxc.DefaultAttachOptions
 	options.ClearEnv = false
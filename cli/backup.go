@@ -95,11 +95,11 @@ func BackupContainer(container string, full, stop bool) {
 		fs.SetVolReadOnly(containerSnapshotName, true)
 
 		if full {
-			fs.Send(containerSnapshotDir+"/"+subvolBase, containerSnapshotDir+"/"+subvolBase,
-				tmpBackupDir+subvolBase+".delta")
+			log.Check(log.FatalLevel, "Sending delta "+subvolBase, fs.Send(containerSnapshotDir+"/"+subvolBase,
+				containerSnapshotDir+"/"+subvolBase, tmpBackupDir+subvolBase+".delta"))
 		} else {
-			fs.Send(lastSnapshotDir+"/"+subvolBase, containerSnapshotDir+"/"+subvolBase,
-				tmpBackupDir+subvolBase+".delta")
+			log.Check(log.FatalLevel, "Sending delta "+subvolBase, fs.Send(lastSnapshotDir+"/"+subvolBase,
+				containerSnapshotDir+"/"+subvolBase, tmpBackupDir+subvolBase+".delta"))
 		}
 
 		if lastSnapshotDir != "" {
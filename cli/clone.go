@@ -3,6 +3,8 @@ package cli
 import (
 	"net"
 	"strings"
+	"sync"
+	"time"
 
 	"github.com/subutai-io/agent/config"
 	"github.com/subutai-io/agent/db"
@@ -36,34 +38,66 @@ func LxcClone(parent, child, envId, addr, token, kurjToken string) {
 	if container.IsContainer(child) {
 		log.Error("Container " + child + " already exist")
 	}
-	container.Clone(parent, child)
-	gpg.GenerateKey(child)
-
-	if len(token) != 0 {
-		gpg.ExchageAndEncrypt(child, token)
-	}
-
-	if len(envId) != 0 {
-		container.SetEnvID(child, envId)
-		meta["environment"] = envId
+	if container.IsStandby(child) {
+		log.Error("Container name " + child + " is reserved for warm pool")
 	}
 
+	var conf [][]string
 	if ip := strings.Fields(addr); len(ip) > 1 {
-		addNetConf(child, addr)
+		conf = cloneNetConf(addr)
 		meta["ip"] = strings.Split(ip[0], "/")[0]
 		meta["vlan"] = ip[1]
 	}
+	if len(envId) != 0 {
+		meta["environment"] = envId
+	}
 
-	container.SetContainerUID(child)
-
-	//Need to change it in parent templates
-	container.SetApt(child)
-	container.SetDNS(child)
-
-	//Security matters workaround. Need to change it in parent templates
-	container.DisableSSHPwd(child)
-
-	LxcStart(child)
+	steps := []step{
+		{name: "key", deps: []string{"clone"}, run: func() {
+			gpg.GenerateKey(child)
+			if len(token) != 0 {
+				gpg.ExchageAndEncrypt(child, token)
+			}
+		}},
+		{name: "rootfs", deps: []string{"clone"}, run: func() {
+			if len(envId) != 0 {
+				container.SetEnvID(child, envId)
+			}
+			if len(conf) != 0 {
+				container.SetStaticNet(child)
+			}
+		}},
+		{name: "settings", deps: []string{"uid"}, run: func() {
+			//Need to change it in parent templates
+			container.SetApt(child)
+			container.SetDNS(child)
+
+			//Security matters workaround. Need to change it in parent templates
+			container.DisableSSHPwd(child)
+		}},
+		{name: "start", deps: []string{"key", "settings"}, run: func() { LxcStart(child) }},
+	}
+	if claim(parent, child) {
+		steps = append(steps,
+			step{name: "clone", run: func() {
+				if len(conf) != 0 {
+					container.SetContainerConf(child, conf)
+				}
+			}},
+			step{name: "uid", deps: []string{"rootfs"}, run: func() {}},
+		)
+	} else {
+		steps = append(steps,
+			step{name: "clone", run: func() { container.Clone(parent, child, conf...) }},
+			// UID is allocated once the container exists, so destroying the container frees it if a later step fails
+			step{name: "uid", deps: []string{"rootfs"}, run: func() {
+				uid := container.AllocUID(child)
+				container.SetContainerConf(child, container.UIDConf(uid))
+				container.ShiftUID(child, uid)
+			}},
+		)
+	}
+	runSteps(steps)
 
 	meta["interface"] = container.GetConfigItem(config.Agent.LxcPrefix+child+"/config", "lxc.network.veth.pair")
 
@@ -75,8 +109,8 @@ func LxcClone(parent, child, envId, addr, token, kurjToken string) {
 	log.Info(child + " with ID " + gpg.GetFingerprint(child) + " successfully cloned")
 }
 
-// addNetConf adds network related configuration values to container config file
-func addNetConf(name, addr string) {
+// cloneNetConf returns network related configuration values for container config file
+func cloneNetConf(addr string) [][]string {
 	ipvlan := strings.Fields(addr)
 	gateway := getEnvGw(ipvlan[1])
 	if len(gateway) == 0 {
@@ -87,12 +121,41 @@ func addNetConf(name, addr string) {
 		gateway = net.IP(gw).String()
 	}
 
-	container.SetContainerConf(name, [][]string{
+	return [][]string{
 		{"lxc.network.ipv4", ipvlan[0]},
 		{"lxc.network.ipv4.gateway", gateway},
 		{"#vlan_id", ipvlan[1]},
-	})
-	container.SetStaticNet(name)
+	}
+}
+
+// step is a named stage of the clone pipeline which starts after all its dependencies are done
+type step struct {
+	name string
+	deps []string
+	run  func()
+}
+
+// runSteps executes steps concurrently respecting their dependencies and reports time spent on each of them
+func runSteps(steps []step) {
+	done := make(map[string]chan struct{})
+	for _, s := range steps {
+		done[s.name] = make(chan struct{})
+	}
+	var wg sync.WaitGroup
+	for _, s := range steps {
+		wg.Add(1)
+		go func(s step) {
+			defer wg.Done()
+			for _, d := range s.deps {
+				<-done[d]
+			}
+			start := time.Now()
+			s.run()
+			log.Debug("Clone step " + s.name + " took " + time.Since(start).String())
+			close(done[s.name])
+		}(s)
+	}
+	wg.Wait()
 }
 
 func getEnvGw(vlan string) string {
@@ -0,0 +1,183 @@
+package cli
+
+import (
+	"archive/tar"
+	"errors"
+	"fmt"
+	"io"
+	"io/ioutil"
+	"net/http"
+	"os"
+	"path"
+	"path/filepath"
+	"strings"
+
+	"github.com/cheggaaa/pb"
+
+	"github.com/subutai-io/agent/config"
+	"github.com/subutai-io/agent/lib/container"
+	"github.com/subutai-io/agent/lib/fs"
+	"github.com/subutai-io/agent/lib/template"
+	"github.com/subutai-io/agent/log"
+)
+
+var (
+	// errParent means that parent template should be imported before the deltas of its child are received.
+	errParent = errors.New("Parent template is not installed")
+	// errResume means that the archive was partially downloaded by previous import and fetch should continue it.
+	errResume = errors.New("Archive is partially downloaded")
+)
+
+// deploy installs the template from the archive read from the stream. Deltas are piped into btrfs receive as they are read
+// and other files are written to tmpdir/<name>, so the archive is not extracted to disk. Config is the first file of the archive,
+// if the parent template from it is not installed errParent is returned with the parent name before receiving any delta.
+func deploy(name string, r io.Reader) (parent string, err error) {
+	templdir := config.Agent.LxcPrefix + "tmpdir/" + name
+	zr, err := fs.Decompress(r)
+	if err != nil {
+		return "", err
+	}
+	defer zr.Close()
+	tr := tar.NewReader(zr)
+	received := false
+	for {
+		hdr, err := tr.Next()
+		if err == io.EOF {
+			break
+		} else if err != nil {
+			return parent, err
+		}
+		file := strings.TrimPrefix(path.Clean("/"+hdr.Name), "/")
+		if len(file) == 0 || hdr.Typeflag == tar.TypeDir {
+			continue
+		}
+
+		if strings.HasPrefix(file, "deltas/") && strings.HasSuffix(file, ".delta") {
+			if !received {
+				parent = container.GetConfigItem(templdir+"/config", "subutai.parent")
+				if parent != "" && parent != name && !container.IsTemplate(parent) {
+					return parent, errParent
+				}
+				log.Info("Installing template " + name)
+				fs.SubvolumeCreate(config.Agent.LxcPrefix + name)
+				received = true
+			}
+			vol := strings.TrimSuffix(path.Base(file), ".delta")
+			if err = template.Receive(parent, name, vol, tr); err != nil {
+				return parent, err
+			}
+			continue
+		}
+
+		dst := filepath.Join(templdir, file)
+		if err = os.MkdirAll(filepath.Dir(dst), 0755); err != nil {
+			return parent, err
+		}
+		out, err := os.OpenFile(dst, os.O_WRONLY|os.O_CREATE|os.O_TRUNC, os.FileMode(hdr.Mode).Perm())
+		if err != nil {
+			return parent, err
+		}
+		_, err = io.Copy(out, tr)
+		out.Close()
+		if err != nil {
+			return parent, err
+		}
+	}
+	// rest of compressed stream is read, so the whole archive is hashed by the caller
+	_, err = io.Copy(ioutil.Discard, zr)
+	return parent, err
+}
+
+// rollback removes partially deployed template.
+func rollback(name string) {
+	log.Debug("Removing partially installed template " + name)
+	if _, err := os.Stat(config.Agent.LxcPrefix + name); err == nil {
+		fs.SubvolumeDestroy(config.Agent.LxcPrefix + name)
+	}
+	os.RemoveAll(config.Agent.LxcPrefix + "tmpdir/" + name)
+}
+
+// stream downloads the template and deploys it on the fly. The archive is stored in tmpdir only if caching is enabled in [cdn] section,
+// it's written to the part file of fetch, so the download which fails in the middle continues from there.
+// Archive is verified when the stream ends and the template is removed if the hash doesn't match.
+// httpError is returned if the template is not available from url, nil error means the template is deployed.
+// Part file left by previous import is not overwritten, errResume is returned instead to continue it with fetch.
+func stream(t templ, kurjun *http.Client, url, token string, torrent bool) error {
+	sum, algo := idHash(t.id)
+	if len(algo) == 0 {
+		return errors.New("Unknown hash of template id " + t.id)
+	}
+	archive := config.Agent.LxcPrefix + "tmpdir/" + t.file
+	if partial(archive) {
+		return errResume
+	}
+	for {
+		response, err := kurjun.Get(url)
+		if err != nil {
+			return err
+		}
+		if response.StatusCode != http.StatusOK {
+			response.Body.Close()
+			return httpError(response.Status)
+		}
+
+		h := digests[algo]()
+		bar := pb.New64(response.ContentLength).SetUnits(pb.U_BYTES)
+		bar.Start()
+		src := io.TeeReader(bar.NewProxyReader(response.Body), h)
+		var cache *os.File
+		if config.CDN.Cache {
+			os.Remove(archive + ".part.map")
+			if tag := validator(response); len(tag) != 0 {
+				log.Check(log.DebugLevel, "Saving validator of "+t.file, ioutil.WriteFile(archive+".part.tag", []byte(tag), 0644))
+			}
+			if cache, err = os.Create(archive + ".part"); err != nil {
+				response.Body.Close()
+				return err
+			}
+			src = io.TeeReader(src, cache)
+		}
+
+		parent, err := deploy(t.name, src)
+		if err == nil {
+			_, err = io.Copy(ioutil.Discard, src)
+		}
+		response.Body.Close()
+		bar.Finish()
+		if cache != nil {
+			if cerr := cache.Close(); err == nil {
+				err = cerr
+			}
+		}
+
+		if err == errParent {
+			rollback(t.name)
+			log.Info("Parent template required: " + parent)
+			LxcImport(parent, "", token, torrent)
+			continue
+		}
+		if err == nil && sum != fmt.Sprintf("%x", h.Sum(nil)) {
+			err = errors.New("Hash sum of " + t.file + " doesn't match template id")
+			os.Remove(archive + ".part")
+		}
+		if err != nil {
+			rollback(t.name)
+			return err
+		}
+		if cache != nil {
+			os.Remove(archive + ".part.tag")
+			log.Check(log.WarnLevel, "Saving "+t.file, os.Rename(archive+".part", archive))
+			cacheAdd(archive, t.name, algo, sum, true)
+		}
+		return nil
+	}
+}
+
+// partial returns true if the archive has the part file with its validator, so fetch can resume it with If-Range.
+func partial(archive string) bool {
+	if _, err := os.Stat(archive + ".part.tag"); err != nil {
+		return false
+	}
+	st, err := os.Stat(archive + ".part")
+	return err == nil && st.Size() > 0
+}
@@ -22,7 +22,6 @@ import (
 // even if some instance components were already removed, the destroy command will continue to perform all operations
 // once again while ignoring possible underlying errors: i.e. missing configuration files.
 func LxcDestroy(id string, vlan bool) {
-	var v string
 	var msg string
 	if len(id) == 0 {
 		log.Error("Please specify container/template name or vlan id")
@@ -62,22 +61,30 @@ func LxcDestroy(id string, vlan bool) {
 				ProxyDel(vlan, ip, false)
 			}
 		}
+		if container.IsTemplate(id) {
+			drain(id, 0)
+			bolt, err := db.New()
+			log.Check(log.WarnLevel, "Opening database", err)
+			log.Check(log.WarnLevel, "Removing warm pool", bolt.PoolSet(id, 0))
+			log.Check(log.WarnLevel, "Closing database", bolt.Close())
+		}
 		net.DelIface(c["interface"])
 		container.Destroy(id)
 	}
 
 	if id == "everything" {
+		vlans := make(map[string]bool)
 		for _, c := range container.Containers() {
 			if vlan := container.GetConfigItem(config.Agent.LxcPrefix+c+"/config", "#vlan_id"); len(vlan) != 0 {
-				if vlan != v {
-					LxcDestroy(vlan, true)
-					cleanupNet(vlan)
-					v = vlan
-				}
-			} else {
-				LxcDestroy(c, false)
+				vlans[vlan] = true
 			}
+			LxcDestroy(c, false)
 		}
+		var list []string
+		for vlan := range vlans {
+			list = append(list, vlan)
+		}
+		cleanupNet(list...)
 		msg = id + " is destroyed"
 	}
 
@@ -90,11 +97,27 @@ func LxcDestroy(id string, vlan bool) {
 	log.Info(msg)
 }
 
-func cleanupNet(id string) {
-	net.DelIface("gw-" + id)
-	p2p.RemoveByIface("p2p" + id)
-	cleanupNetStat(id)
-	ProxyDel(id, "", true)
+// cleanupNet removes network resources of the VLANs, p2p interfaces of all of them are removed at once.
+func cleanupNet(ids ...string) {
+	var ifaces []string
+	for _, id := range ids {
+		net.DelIface("gw-" + id)
+		ifaces = append(ifaces, "p2p"+id)
+	}
+	if len(ifaces) != 0 {
+		p2p.RemoveByIface(ifaces...)
+	}
+	for _, id := range ids {
+		cleanupNetStat(id)
+		ProxyDel(id, "", true)
+	}
+
+	bolt, err := db.New()
+	log.Check(log.WarnLevel, "Opening database", err)
+	for _, id := range ids {
+		log.Check(log.WarnLevel, "Removing environment quota", bolt.VlanQuota(id, ""))
+	}
+	log.Check(log.WarnLevel, "Closing database", bolt.Close())
 }
 
 // cleanupNetStat drops data from database about network trafic for specified VLAN
@@ -0,0 +1,473 @@
+package cli
+
+import (
+	"bufio"
+	"errors"
+	"fmt"
+	"hash"
+	"io"
+	"io/ioutil"
+	"net/http"
+	"os"
+	"strconv"
+	"strings"
+	"sync"
+	"syscall"
+	"time"
+
+	"github.com/cheggaaa/pb"
+
+	"github.com/subutai-io/agent/config"
+	"github.com/subutai-io/agent/log"
+)
+
+const (
+	// minParallel is the smallest file downloaded over several connections
+	minParallel = 16 << 20
+	// chunk sizes of parallel download, each connection doubles its chunk while chunks come fast and halves it on slow or failed ones
+	minChunk  = 1 << 20
+	initChunk = 4 << 20
+	maxChunk  = 64 << 20
+)
+
+var errChanged = errors.New("File changed on server during download")
+
+// httpError is the status of unexpected server response.
+type httpError string
+
+func (e httpError) Error() string {
+	return string(e)
+}
+
+// fetch downloads the file from url to path. Data is written to path.part file which is renamed when the download completes,
+// interrupted download continues from the size of the part file with Range request, including a new run of import.
+// Validator of the file (ETag or Last-Modified) is kept in path.part.tag and sent in If-Range header,
+// so the server returns the whole file if it was changed since the part was downloaded.
+// Large files are downloaded over several connections if the server supports ranges, see fetchParallel.
+// Data is hashed with h as it's written, so the archive is not read again to verify it.
+// Quiet download doesn't print progress bar, it's used for concurrent downloads.
+func fetch(kurjun *http.Client, url, path string, h hash.Hash, quiet bool) error {
+	part := path + ".part"
+	d := &digester{Hash: h}
+	if config.CDN.Connections > 1 {
+		if size, tag := ranges(kurjun, url); size >= minParallel {
+			err := fetchParallel(kurjun, url, path, size, tag, d, quiet)
+			if err == errChanged {
+				os.Remove(part + ".map")
+			}
+			return err
+		}
+	}
+	// part file of parallel download is preallocated, its size is not the downloaded size
+	if _, err := os.Stat(part + ".map"); err == nil {
+		os.Remove(part)
+		os.Remove(part + ".map")
+	}
+
+	out, err := os.OpenFile(part, os.O_RDWR|os.O_CREATE, 0644)
+	if err != nil {
+		return err
+	}
+	defer out.Close()
+
+	for c := 0; ; c++ {
+		var done bool
+		var written int64
+		done, written, err = fetchPart(kurjun, url, part, out, d, quiet)
+		if done {
+			break
+		}
+		// counter is reset by progress, so downloads over flaky links finish while dead links fail fast
+		if written > 0 {
+			c = 0
+		}
+		// missing file won't appear on retry
+		if _, ok := err.(httpError); ok || c >= 5 {
+			return err
+		}
+		log.Info("Download interrupted, retrying")
+		log.Debug(err.Error())
+		time.Sleep(3 * time.Second)
+	}
+	if err = out.Close(); err != nil {
+		return err
+	}
+	os.Remove(part + ".tag")
+	return os.Rename(part, path)
+}
+
+// fetchPart requests the rest of the file and appends it to the part file.
+// It returns true if the file is complete and the number of bytes written.
+func fetchPart(kurjun *http.Client, url, part string, out *os.File, d *digester, quiet bool) (bool, int64, error) {
+	offset, err := out.Seek(0, io.SeekEnd)
+	if err != nil {
+		return false, 0, err
+	}
+	tag, _ := ioutil.ReadFile(part + ".tag")
+
+	req, err := http.NewRequest("GET", url, nil)
+	if err != nil {
+		return false, 0, err
+	}
+	if offset > 0 && len(tag) > 0 {
+		req.Header.Set("Range", "bytes="+strconv.FormatInt(offset, 10)+"-")
+		req.Header.Set("If-Range", string(tag))
+	}
+	response, err := kurjun.Do(req)
+	if err != nil {
+		// response refused by the transport won't change on retry
+		var refused httpError
+		if errors.As(err, &refused) {
+			return false, 0, refused
+		}
+		return false, 0, err
+	}
+	defer response.Body.Close()
+
+	switch {
+	case response.StatusCode == http.StatusPartialContent && strings.HasPrefix(response.Header.Get("Content-Range"), "bytes "+strconv.FormatInt(offset, 10)+"-"):
+		log.Debug("Resuming download from " + strconv.FormatInt(offset, 10) + " bytes")
+		// bytes read before failed write were hashed but not written
+		if d.n > offset {
+			d.Reset()
+			d.n = 0
+		}
+		if err = d.catchUp(out, offset); err != nil {
+			return false, 0, err
+		}
+	case response.StatusCode == http.StatusRequestedRangeNotSatisfiable:
+		// part file is larger than the file on server, it's downloaded again
+		out.Truncate(0)
+		return false, 0, errors.New(response.Status)
+	case response.StatusCode == http.StatusOK:
+		if offset, err = out.Seek(0, io.SeekStart); err != nil {
+			return false, 0, err
+		}
+		if err = out.Truncate(0); err != nil {
+			return false, 0, err
+		}
+		d.Reset()
+		d.n = 0
+		if tag := validator(response); len(tag) == 0 {
+			os.Remove(part + ".tag")
+		} else if err = ioutil.WriteFile(part+".tag", []byte(tag), 0644); err != nil {
+			return false, 0, err
+		}
+	default:
+		return false, 0, httpError(response.Status)
+	}
+
+	bar := pb.New64(offset + response.ContentLength).SetUnits(pb.U_BYTES)
+	bar.NotPrint = quiet
+	bar.Set64(offset)
+	bar.Start()
+	written, err := io.Copy(out, io.TeeReader(bar.NewProxyReader(response.Body), d))
+	bar.Finish()
+	if err == nil && response.ContentLength >= 0 && written != response.ContentLength {
+		err = io.ErrUnexpectedEOF
+	}
+	return err == nil, written, err
+}
+
+// validator returns strong validator of the response usable in If-Range header, weak ETags can't be used for ranges.
+func validator(response *http.Response) string {
+	tag := response.Header.Get("ETag")
+	if len(tag) == 0 {
+		tag = response.Header.Get("Last-Modified")
+	}
+	if strings.HasPrefix(tag, "W/") {
+		return ""
+	}
+	return tag
+}
+
+// ranges requests the first byte of the file to check if the server supports ranges.
+// It returns the size and the validator of the file, zero size means ranges can't be used.
+func ranges(kurjun *http.Client, url string) (int64, string) {
+	req, err := http.NewRequest("GET", url, nil)
+	if err != nil {
+		return 0, ""
+	}
+	req.Header.Set("Range", "bytes=0-0")
+	response, err := kurjun.Do(req)
+	if err != nil {
+		return 0, ""
+	}
+	response.Body.Close()
+	tag := validator(response)
+	if response.StatusCode != http.StatusPartialContent || len(tag) == 0 {
+		return 0, ""
+	}
+	cr := response.Header.Get("Content-Range")
+	size, err := strconv.ParseInt(cr[strings.LastIndex(cr, "/")+1:], 10, 64)
+	if err != nil {
+		return 0, ""
+	}
+	return size, tag
+}
+
+// chunk is a byte range of the file, end is exclusive.
+type chunk struct {
+	start, end int64
+}
+
+// chunks keeps the ranges left to download and hands them out to the connections.
+type chunks struct {
+	sync.Mutex
+	gaps []chunk
+}
+
+// next cuts the range of up to n bytes from the beginning of the first gap, tail shorter than a quarter of n is not left behind.
+func (c *chunks) next(n int64) (chunk, bool) {
+	c.Lock()
+	defer c.Unlock()
+	if len(c.gaps) == 0 {
+		return chunk{}, false
+	}
+	g := c.gaps[0]
+	if g.end-g.start <= n+n/4 {
+		c.gaps = c.gaps[1:]
+		return g, true
+	}
+	c.gaps[0].start += n
+	return chunk{g.start, g.start + n}, true
+}
+
+// fetchParallel downloads the file over config.CDN.Connections connections, each requesting its own ranges and writing them
+// with pwrite into the preallocated part file. Completed ranges are appended to path.part.map, so interrupted download
+// continues with missing ranges only. Part file left by single stream download with the same validator is reused as well.
+// Contiguous prefix of the file is hashed as ranges complete, reading the data just written from page cache.
+func fetchParallel(kurjun *http.Client, url, path string, size int64, tag string, d *digester, quiet bool) error {
+	part := path + ".part"
+	out, err := os.OpenFile(part, os.O_RDWR|os.O_CREATE, 0644)
+	if err != nil {
+		return err
+	}
+	defer out.Close()
+
+	var done []chunk
+	if old, _ := ioutil.ReadFile(part + ".tag"); string(old) == tag {
+		if done = loadMap(part + ".map"); done == nil {
+			if st, err := out.Stat(); err == nil && st.Size() > 0 && st.Size() <= size {
+				done = []chunk{{0, st.Size()}}
+			}
+		}
+	} else if err = ioutil.WriteFile(part+".tag", []byte(tag), 0644); err != nil {
+		return err
+	}
+	if done == nil {
+		os.Remove(part + ".map")
+		if err = out.Truncate(0); err != nil {
+			return err
+		}
+	}
+	if syscall.Fallocate(int(out.Fd()), 0, 0, size) != nil {
+		if err = out.Truncate(size); err != nil {
+			return err
+		}
+	}
+	m, err := os.OpenFile(part+".map", os.O_WRONLY|os.O_CREATE|os.O_APPEND, 0644)
+	if err != nil {
+		return err
+	}
+	defer m.Close()
+	for _, c := range done {
+		fmt.Fprintln(m, c.start, c.end)
+	}
+
+	// ends maps starts of completed ranges to their ends to follow the contiguous prefix
+	ends := make(map[int64]int64)
+	for _, c := range done {
+		ends[c.start] = c.end
+	}
+	d.Reset()
+	d.n = 0
+
+	list := &chunks{gaps: missing(done, size)}
+	left := int64(0)
+	for _, g := range list.gaps {
+		left += g.end - g.start
+	}
+	log.Debug("Downloading " + strconv.FormatInt(left, 10) + " bytes over " + strconv.Itoa(config.CDN.Connections) + " connections")
+	bar := pb.New64(size).SetUnits(pb.U_BYTES)
+	bar.NotPrint = quiet
+	bar.Set64(size - left)
+	bar.Start()
+
+	var wg sync.WaitGroup
+	var mu sync.Mutex
+	var failed error
+	for i := 0; i < config.CDN.Connections; i++ {
+		wg.Add(1)
+		go func() {
+			defer wg.Done()
+			n := int64(initChunk)
+			for {
+				mu.Lock()
+				stop := failed != nil
+				mu.Unlock()
+				c, ok := list.next(n)
+				if stop || !ok {
+					return
+				}
+				start := time.Now()
+				if err := fetchRange(kurjun, url, tag, out, c, bar); err != nil {
+					mu.Lock()
+					failed = err
+					mu.Unlock()
+					return
+				}
+				mu.Lock()
+				_, err := fmt.Fprintln(m, c.start, c.end)
+				log.Check(log.DebugLevel, "Saving downloaded range", err)
+				ends[c.start] = c.end
+				prefix := d.n
+				for end, ok := ends[prefix]; ok; end, ok = ends[prefix] {
+					prefix = end
+				}
+				if err := d.catchUp(out, prefix); err != nil && failed == nil {
+					failed = err
+				}
+				mu.Unlock()
+
+				if d := time.Since(start); d < 2*time.Second && n < maxChunk {
+					n *= 2
+				} else if d > 8*time.Second && n > minChunk {
+					n /= 2
+				}
+			}
+		}()
+	}
+	wg.Wait()
+	bar.Finish()
+	if failed != nil {
+		return failed
+	}
+	if err = d.catchUp(out, size); err != nil {
+		return err
+	}
+
+	if err = out.Close(); err != nil {
+		return err
+	}
+	os.Remove(part + ".map")
+	os.Remove(part + ".tag")
+	return os.Rename(part, path)
+}
+
+// fetchRange downloads the range of the file, retrying from the last written byte.
+func fetchRange(kurjun *http.Client, url, tag string, out *os.File, c chunk, bar *pb.ProgressBar) error {
+	var err error
+	for i := 0; i < 5; i++ {
+		if i > 0 {
+			log.Debug("Range " + strconv.FormatInt(c.start, 10) + "-" + strconv.FormatInt(c.end, 10) + " interrupted, retrying: " + err.Error())
+			time.Sleep(3 * time.Second)
+		}
+		var req *http.Request
+		if req, err = http.NewRequest("GET", url, nil); err != nil {
+			return err
+		}
+		req.Header.Set("Range", "bytes="+strconv.FormatInt(c.start, 10)+"-"+strconv.FormatInt(c.end-1, 10))
+		req.Header.Set("If-Range", tag)
+		var response *http.Response
+		if response, err = kurjun.Do(req); err != nil {
+			continue
+		}
+		if response.StatusCode == http.StatusOK {
+			response.Body.Close()
+			return errChanged
+		}
+		if response.StatusCode != http.StatusPartialContent || !strings.HasPrefix(response.Header.Get("Content-Range"), "bytes "+strconv.FormatInt(c.start, 10)+"-") {
+			response.Body.Close()
+			err = errors.New(response.Status)
+			continue
+		}
+		var written int64
+		written, err = io.Copy(&rangeWriter{out, c.start}, bar.NewProxyReader(io.LimitReader(response.Body, c.end-c.start)))
+		response.Body.Close()
+		if c.start += written; c.start >= c.end {
+			return nil
+		}
+		if err == nil {
+			err = io.ErrUnexpectedEOF
+		}
+		if written > 0 {
+			i = 0
+		}
+	}
+	return err
+}
+
+// digester hashes the file as it's written, n is the size of hashed prefix.
+type digester struct {
+	hash.Hash
+	n int64
+}
+
+func (d *digester) Write(p []byte) (int, error) {
+	n, err := d.Hash.Write(p)
+	d.n += int64(n)
+	return n, err
+}
+
+// catchUp hashes the bytes of the file between the hashed prefix and end.
+func (d *digester) catchUp(f *os.File, end int64) error {
+	if end <= d.n {
+		return nil
+	}
+	_, err := io.Copy(d, io.NewSectionReader(f, d.n, end-d.n))
+	return err
+}
+
+// rangeWriter writes to the file at increasing offset.
+type rangeWriter struct {
+	f   *os.File
+	off int64
+}
+
+func (w *rangeWriter) Write(p []byte) (int, error) {
+	n, err := w.f.WriteAt(p, w.off)
+	w.off += int64(n)
+	return n, err
+}
+
+// loadMap reads ranges completed by previous parallel download.
+func loadMap(path string) (list []chunk) {
+	f, err := os.Open(path)
+	if err != nil {
+		return nil
+	}
+	defer f.Close()
+	scanner := bufio.NewScanner(f)
+	for scanner.Scan() {
+		var c chunk
+		if _, err := fmt.Sscan(scanner.Text(), &c.start, &c.end); err == nil && c.start < c.end {
+			list = append(list, c)
+		}
+	}
+	return list
+}
+
+// missing returns the ranges of the file which are not covered by the completed ones.
+func missing(done []chunk, size int64) []chunk {
+	var gaps []chunk
+	for pos := int64(0); pos < size; {
+		next := size
+		covered := false
+		for _, c := range done {
+			if c.start <= pos && c.end > pos {
+				pos = c.end
+				covered = true
+				break
+			}
+			if c.start > pos && c.start < next {
+				next = c.start
+			}
+		}
+		if !covered {
+			gaps = append(gaps, chunk{pos, next})
+			pos = next
+		}
+	}
+	return gaps
+}
@@ -0,0 +1,265 @@
+package cli
+
+import (
+	"bytes"
+	"crypto/sha256"
+	"errors"
+	"fmt"
+	"io/ioutil"
+	"math/rand"
+	"net/http"
+	"net/http/httptest"
+	"os"
+	"path/filepath"
+	"strings"
+	"sync"
+	"testing"
+	"time"
+
+	"github.com/subutai-io/agent/config"
+)
+
+// file is served by rangeServer with ETag validator, Range and If-Range are handled by http.ServeContent.
+type file struct {
+	data []byte
+	tag  string
+}
+
+// rangeServer serves the file and counts the requests and body bytes sent. The first cuts responses are broken
+// after cut bytes, the file is replaced with next after change requests.
+type rangeServer struct {
+	sync.Mutex
+	file
+	next     file
+	change   int
+	cut      int64
+	cuts     int
+	requests int
+	ranges   int
+	sent     int64
+}
+
+func (s *rangeServer) ServeHTTP(w http.ResponseWriter, r *http.Request) {
+	s.Lock()
+	s.requests++
+	if s.change > 0 && s.requests > s.change {
+		s.file, s.change = s.next, 0
+	}
+	f := s.file
+	limit := int64(-1)
+	if r.Header.Get("Range") != "bytes=0-0" && s.cuts > 0 {
+		s.cuts--
+		limit = s.cut
+	}
+	if strings.HasPrefix(r.Header.Get("Range"), "bytes=") && r.Header.Get("If-Range") == f.tag {
+		s.ranges++
+	}
+	s.Unlock()
+
+	w.Header().Set("ETag", f.tag)
+	http.ServeContent(&cutWriter{ResponseWriter: w, s: s, left: limit}, r, "", time.Time{}, bytes.NewReader(f.data))
+}
+
+// cutWriter fails writes after left bytes, unless left is negative, so the client gets short body.
+type cutWriter struct {
+	http.ResponseWriter
+	s    *rangeServer
+	left int64
+}
+
+func (w *cutWriter) Write(p []byte) (int, error) {
+	if w.left >= 0 {
+		if w.left == 0 {
+			return 0, errors.New("cut")
+		}
+		if int64(len(p)) > w.left {
+			p = p[:w.left]
+		}
+		w.left -= int64(len(p))
+	}
+	n, err := w.ResponseWriter.Write(p)
+	w.s.Lock()
+	w.s.sent += int64(n)
+	w.s.Unlock()
+	return n, err
+}
+
+func content(size int, seed int64) file {
+	data := make([]byte, size)
+	rand.New(rand.NewSource(seed)).Read(data)
+	return file{data: data, tag: fmt.Sprintf(`"%d"`, seed)}
+}
+
+// fetchFile fetches the file from the server into dir with the number of connections and checks its content and sum.
+func fetchFile(t *testing.T, s *rangeServer, dir string, connections int) error {
+	connections, config.CDN.Connections = config.CDN.Connections, connections
+	defer func() { config.CDN.Connections = connections }()
+
+	srv := httptest.NewServer(s)
+	defer srv.Close()
+
+	path := filepath.Join(dir, "template.tar.gz")
+	h := sha256.New()
+	if err := fetch(srv.Client(), srv.URL+"/template", path, h, true); err != nil {
+		return err
+	}
+	data, err := ioutil.ReadFile(path)
+	if err != nil {
+		t.Fatal(err)
+	}
+	s.Lock()
+	want := s.data
+	s.Unlock()
+	if !bytes.Equal(data, want) {
+		t.Fatal("downloaded file differs from the served one")
+	}
+	if sum := sha256.Sum256(want); !bytes.Equal(h.Sum(nil), sum[:]) {
+		t.Fatal("hash of the download doesn't match the file")
+	}
+	for _, ext := range []string{".part", ".part.map", ".part.tag"} {
+		if _, err := os.Stat(path + ext); err == nil {
+			t.Errorf("%s is left after download", ext)
+		}
+	}
+	return nil
+}
+
+func tempDir(t *testing.T) string {
+	dir, err := ioutil.TempDir("", "download")
+	if err != nil {
+		t.Fatal(err)
+	}
+	return dir
+}
+
+func TestFetchParallel(t *testing.T) {
+	dir := tempDir(t)
+	defer os.RemoveAll(dir)
+
+	s := &rangeServer{file: content(minParallel+3<<20+123, 1), cut: 1 << 20, cuts: 1}
+	if err := fetchFile(t, s, dir, 4); err != nil {
+		t.Fatal(err)
+	}
+	if s.ranges < 4 {
+		t.Errorf("file is downloaded in %d ranges", s.ranges)
+	}
+}
+
+func TestFetchParallelResume(t *testing.T) {
+	dir := tempDir(t)
+	defer os.RemoveAll(dir)
+
+	f := content(minParallel+5<<20, 2)
+	part := filepath.Join(dir, "template.tar.gz.part")
+	// completed ranges hold the data, the rest of preallocated file is garbage which must be downloaded
+	data := make([]byte, len(f.data))
+	copy(data[:3<<20], f.data)
+	copy(data[8<<20:12<<20], f.data[8<<20:])
+	copy(data[3<<20:8<<20], bytes.Repeat([]byte{0xff}, 5<<20))
+	ioutil.WriteFile(part, data, 0644)
+	ioutil.WriteFile(part+".tag", []byte(f.tag), 0644)
+	ioutil.WriteFile(part+".map", []byte(fmt.Sprintln(0, 3<<20)+fmt.Sprintln(8<<20, 12<<20)), 0644)
+
+	s := &rangeServer{file: f}
+	if err := fetchFile(t, s, dir, 4); err != nil {
+		t.Fatal(err)
+	}
+	// the probe sends one byte
+	if left := int64(len(f.data) - 7<<20 + 1); s.sent != left {
+		t.Errorf("%d bytes sent, want %d", s.sent, left)
+	}
+}
+
+func TestFetchParallelChanged(t *testing.T) {
+	dir := tempDir(t)
+	defer os.RemoveAll(dir)
+
+	old := content(minParallel+1<<20, 3)
+	part := filepath.Join(dir, "template.tar.gz.part")
+	ioutil.WriteFile(part, old.data, 0644)
+	ioutil.WriteFile(part+".tag", []byte(old.tag), 0644)
+	ioutil.WriteFile(part+".map", []byte(fmt.Sprintln(0, 2<<20)), 0644)
+
+	// the probe still sees the old file, the ranges get the new one
+	s := &rangeServer{file: old, next: content(minParallel+2<<20, 4), change: 1}
+	if err := fetchFile(t, s, dir, 4); err != errChanged {
+		t.Fatalf("changed file is not detected: %v", err)
+	}
+	if _, err := os.Stat(part + ".map"); err == nil {
+		t.Error("map of the changed file is kept")
+	}
+	if err := fetchFile(t, s, dir, 4); err != nil {
+		t.Fatal(err)
+	}
+}
+
+func TestFetchResume(t *testing.T) {
+	dir := tempDir(t)
+	defer os.RemoveAll(dir)
+
+	f := content(3<<20, 5)
+	part := filepath.Join(dir, "template.tar.gz.part")
+	ioutil.WriteFile(part, f.data[:1<<20], 0644)
+	ioutil.WriteFile(part+".tag", []byte(f.tag), 0644)
+
+	// the part left by previous run is hashed from disk, the interrupted response is resumed in this run
+	s := &rangeServer{file: f, cut: 1 << 20, cuts: 1}
+	if err := fetchFile(t, s, dir, 1); err != nil {
+		t.Fatal(err)
+	}
+	if s.ranges != 2 || s.sent != 2<<20 {
+		t.Errorf("%d ranges and %d bytes sent, want 2 and %d", s.ranges, s.sent, 2<<20)
+	}
+}
+
+func TestFetchChanged(t *testing.T) {
+	dir := tempDir(t)
+	defer os.RemoveAll(dir)
+
+	old := content(2<<20, 6)
+	part := filepath.Join(dir, "template.tar.gz.part")
+	ioutil.WriteFile(part, old.data[:1<<20], 0644)
+	ioutil.WriteFile(part+".tag", []byte(old.tag), 0644)
+
+	s := &rangeServer{file: content(3<<20, 7)}
+	if err := fetchFile(t, s, dir, 1); err != nil {
+		t.Fatal(err)
+	}
+	if s.ranges != 0 || s.sent != 3<<20 {
+		t.Errorf("%d ranges and %d bytes sent, want the whole file", s.ranges, s.sent)
+	}
+}
+
+func TestMissing(t *testing.T) {
+	got := missing([]chunk{{10, 20}, {0, 5}, {15, 30}}, 40)
+	want := []chunk{{5, 10}, {30, 40}}
+	if fmt.Sprint(got) != fmt.Sprint(want) {
+		t.Errorf("missing = %v, want %v", got, want)
+	}
+	if got := missing(nil, 10); fmt.Sprint(got) != fmt.Sprint([]chunk{{0, 10}}) {
+		t.Errorf("missing of empty map = %v", got)
+	}
+}
+
+func TestPeerLimit(t *testing.T) {
+	dir := tempDir(t)
+	defer os.RemoveAll(dir)
+
+	// the size reported by the repository is smaller than the file the peer sends
+	s := &rangeServer{file: content(2<<20, 8)}
+	srv := httptest.NewServer(s)
+	defer srv.Close()
+	rt, peer := srv.Client().Transport, &http.Client{Transport: &sizeLimit{rt: srv.Client().Transport, max: 1 << 20}}
+	path := filepath.Join(dir, "template.tar.gz")
+	if err := fetch(peer, srv.URL+"/template", path, sha256.New(), true); err != errTooLarge {
+		t.Fatalf("excess is not refused: %v", err)
+	}
+	if st, err := os.Stat(path + ".part"); err != nil || st.Size() > 1<<20 {
+		t.Errorf("more than the limit is written: %v", err)
+	}
+
+	peer.Transport = &sizeLimit{rt: rt, max: 2 << 20}
+	if err := fetch(peer, srv.URL+"/template", path, sha256.New(), true); err != nil {
+		t.Fatal(err)
+	}
+}
@@ -2,6 +2,7 @@ package cli
 
 import (
 	"bytes"
+	"errors"
 	"fmt"
 	"io"
 	"io/ioutil"
@@ -10,6 +11,9 @@ import (
 	"os"
 	"path/filepath"
 	"runtime"
+	"time"
+
+	"github.com/cheggaaa/pb"
 
 	"github.com/subutai-io/agent/config"
 	"github.com/subutai-io/agent/lib/container"
@@ -21,6 +25,13 @@ var (
 	allsizes = []string{"tiny", "small", "medium", "large", "huge"}
 )
 
+// delta is the result of sending a volume of exported template.
+type delta struct {
+	vol  string
+	file string
+	err  error
+}
+
 // cfg declared in promote.go
 
 // LxcExport sub command prepares an archive from a template in the `/mnt/lib/lxc/tmpdir/` path.
@@ -60,37 +71,90 @@ func LxcExport(name, version, prefsize, token string, private bool) {
 	os.MkdirAll(dst+"/deltas", 0755)
 	os.MkdirAll(dst+"/diff", 0755)
 
-	for _, vol := range []string{"rootfs", "home", "opt", "var"} {
-		err := fs.Send(config.Agent.LxcPrefix+parent+"/"+vol, config.Agent.LxcPrefix+name+"/"+vol, dst+"/deltas/"+vol+".delta")
-		log.Check(log.FatalLevel, "Sending delta "+dst+"/deltas/"+vol+".delta", err)
-	}
-
 	// changeConfigFile(name, packageVersion, dst)
+	compression := "gzip"
+	if config.Template.Compression == "zstd" {
+		compression = "zstd"
+	}
 	container.SetContainerConf(name, [][]string{
 		{"subutai.template.package", dst + ".tar.gz"},
 		{"subutai.template.version", version},
 		{"subutai.template.size", size},
+		{"subutai.template.compression", compression},
 	})
 
 	src := config.Agent.LxcPrefix + name
 	fs.Copy(src+"/fstab", dst+"/fstab")
 	fs.Copy(src+"/config", dst+"/config")
 	fs.Copy(src+"/packages", dst+"/packages")
+	files := []string{"config", "fstab", "packages", "diff", "deltas"}
 	if parent != name {
 		fs.Copy(src+"/diff/var.diff", dst+"/diff/var.diff")
 		fs.Copy(src+"/diff/opt.diff", dst+"/diff/opt.diff")
 		fs.Copy(src+"/diff/home.diff", dst+"/diff/home.diff")
 		fs.Copy(src+"/diff/rootfs.diff", dst+"/diff/rootfs.diff")
+		files = append(files, "diff/var.diff", "diff/opt.diff", "diff/home.diff", "diff/rootfs.diff")
 	}
 
 	container.SetContainerConf(name, [][]string{
 		{"subutai.template.package", config.Agent.LxcPrefix + "tmpdir/" + name +
 			"-subutai-template_" + srcver + "_" + runtime.GOARCH + ".tar.gz"},
 		{"subutai.template.version", srcver},
+		{"subutai.template.compression", ""},
 	})
 
-	fs.Tar(dst, dst+".tar.gz")
+	// volumes are sent concurrently while the archive is written, each delta is added to the archive as soon as it's ready.
+	// Errors are collected instead of exiting until all sends finish, so their snapshots and the partial archive are removed.
+	start := time.Now()
+	vols := []string{"rootfs", "home", "opt", "var"}
+	sent := make(chan delta)
+	for _, vol := range vols {
+		go func(vol string) {
+			begin := time.Now()
+			file := dst + "/deltas/" + vol + ".delta"
+			err := fs.Send(config.Agent.LxcPrefix+parent+"/"+vol, config.Agent.LxcPrefix+name+"/"+vol, file)
+			log.Debug("Sending delta of " + vol + " took " + time.Since(begin).String())
+			sent <- delta{vol: vol, file: file, err: err}
+		}(vol)
+	}
+
+	// config goes first, so import knows the parent before any delta
+	archive, err := fs.NewArchive(dst + ".tar.gz")
+	for _, file := range files {
+		if err == nil {
+			err = archive.Add(dst+"/"+file, file)
+		}
+	}
+	for range vols {
+		d := <-sent
+		if d.err != nil {
+			if err == nil {
+				err = d.err
+			}
+			log.Warn("Sending delta " + d.file + ": " + d.err.Error())
+			continue
+		}
+		if err == nil {
+			begin := time.Now()
+			err = archive.Add(d.file, "deltas/"+d.vol+".delta")
+			log.Debug("Packing delta of " + d.vol + " took " + time.Since(begin).String())
+		}
+	}
+	if archive != nil {
+		if cerr := archive.Close(); err == nil {
+			err = cerr
+		}
+	}
+	if err != nil {
+		os.RemoveAll(dst)
+		os.Remove(dst + ".tar.gz")
+		log.Error("Exporting " + name + ": " + err.Error())
+	}
+	log.Debug("Export of " + name + " took " + time.Since(start).String())
+
 	log.Check(log.FatalLevel, "Remove tmpdir", os.RemoveAll(dst))
+	// exported archive is indexed with the hash computed while it was written, so import of the template doesn't download it again
+	cacheAdd(dst+".tar.gz", name, "md5", archive.Sum(), false)
 	log.Info(name + " exported to " + dst + ".tar.gz")
 	if len(token) > 0 {
 		if hash, err := upload(dst+".tar.gz", token, private); err != nil {
@@ -101,51 +165,65 @@ func LxcExport(name, version, prefsize, token string, private bool) {
 	}
 }
 
+// upload sends the archive to Kurjun as multipart form. The form is streamed from the file instead of being built in memory,
+// only the part headers and the fields around the file are buffered, so the request has exact Content-Length.
+// Zstd compressed archives are refused, Kurjun and older agents read only gzip.
 func upload(path, token string, private bool) ([]byte, error) {
+	if compression, err := fs.Compression(path); err != nil {
+		return nil, err
+	} else if compression != "gzip" {
+		return nil, errors.New(filepath.Base(path) + " is " + compression + " compressed, export it with gzip compression to upload")
+	}
 	file, err := os.Open(path)
 	if err != nil {
 		return nil, err
 	}
 	defer file.Close()
-
-	body := &bytes.Buffer{}
-	writer := multipart.NewWriter(body)
-	part, err := writer.CreateFormFile("file", filepath.Base(path))
+	st, err := file.Stat()
 	if err != nil {
 		return nil, err
 	}
-	_, err = io.Copy(part, file)
-	if err != nil {
+
+	form := &bytes.Buffer{}
+	writer := multipart.NewWriter(form)
+	if _, err = writer.CreateFormFile("file", filepath.Base(path)); err != nil {
 		return nil, err
 	}
+	// file content goes between the part header and the fields, which the writer separates with the boundary
+	n := form.Len()
 	if private {
 		_ = writer.WriteField("private", "true")
 	}
 	_ = writer.WriteField("token", token)
+	if err = writer.Close(); err != nil {
+		return nil, err
+	}
+	head, tail := bytes.NewReader(form.Bytes()[:n]), bytes.NewReader(form.Bytes()[n:])
 
-	err = writer.Close()
+	client, err := config.CheckKurjun()
 	if err != nil {
 		return nil, err
 	}
 
-	config.CheckKurjun()
-
+	bar := pb.New64(st.Size()).SetUnits(pb.U_BYTES)
+	bar.Start()
+	defer bar.Finish()
+	body := io.MultiReader(head, bar.NewProxyReader(file), tail)
 	req, err := http.NewRequest("POST", config.CDN.Kurjun+"/template/upload", body)
-	req.Header.Set("Content-Type", writer.FormDataContentType())
 	if err != nil {
 		return nil, err
 	}
-	client := &http.Client{}
+	req.ContentLength = int64(form.Len()) + st.Size()
+	req.Header.Set("Content-Type", writer.FormDataContentType())
 	resp, err := client.Do(req)
 	if err != nil {
 		return nil, err
 	}
+	defer resp.Body.Close()
 
 	if resp.StatusCode != http.StatusOK {
 		out, err := ioutil.ReadAll(resp.Body)
 		return nil, fmt.Errorf("HTTP status: %s; %s; %v", resp.Status, out, err)
 	}
-
-	defer resp.Body.Close()
 	return ioutil.ReadAll(resp.Body)
 }
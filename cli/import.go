@@ -2,16 +2,18 @@ package cli
 
 import (
 	"crypto/md5"
+	"crypto/sha256"
 	"encoding/json"
 	"fmt"
+	"hash"
 	"io"
 	"io/ioutil"
 	"net/http"
 	"os"
+	"strconv"
 	"strings"
 	"time"
 
-	"code.cloudfoundry.org/archiver/extractor"
 	"github.com/cheggaaa/pb"
 	"github.com/nightlyone/lockfile"
 
@@ -34,20 +36,24 @@ type progress struct {
 
 type templ struct {
 	name      string
+	parent    string
 	file      string
 	version   string
 	branch    string
 	id        string
+	size      int64
 	owner     []string
 	signature map[string]string
 }
 
 type metainfo struct {
-	ID    string            `json:"id"`
-	Name  string            `json:"name"`
-	Owner []string          `json:"owner"`
-	File  string            `json:"filename"`
-	Signs map[string]string `json:"signature"`
+	ID     string            `json:"id"`
+	Name   string            `json:"name"`
+	Owner  []string          `json:"owner"`
+	File   string            `json:"filename"`
+	Signs  map[string]string `json:"signature"`
+	Parent string            `json:"parent"`
+	Size   int64             `json:"size"`
 }
 
 // templId retrieves the id of a template on global repository with specified version.
@@ -96,6 +102,8 @@ func templId(t *templ, kurjun *http.Client, token string) {
 	t.id = meta[0].ID
 	t.file = meta[0].File
 	t.signature = meta[0].Signs
+	t.parent = meta[0].Parent
+	t.size = meta[0].Size
 }
 
 // md5sum returns MD5 hash sum of specified file
@@ -113,12 +121,86 @@ func md5sum(filePath string) string {
 	return fmt.Sprintf("%x", hash.Sum(nil))
 }
 
-// checkLocal reads content of local templates folder to check if required archive is present there
+// digests are hash algorithms of template archives, the algorithm of template id is recognized by the length of its hash.
+var digests = map[string]func() hash.Hash{
+	"md5":    md5.New,
+	"sha256": sha256.New,
+}
+
+// idHash returns the hash of template archive from the last part of its id and the name of the hash algorithm,
+// empty algorithm means the hash is not recognized.
+func idHash(id string) (sum, algo string) {
+	sum = id[strings.LastIndex(id, ".")+1:]
+	for name, h := range digests {
+		if len(sum) == h().Size()*2 {
+			return sum, name
+		}
+	}
+	return sum, ""
+}
+
+// fileDigest returns hex hash sum of the file. Sums are cached in file.digest with the size and modification time of the file,
+// so archives kept in tmpdir are not read again by following imports.
+func fileDigest(path, algo string) string {
+	st, err := os.Stat(path)
+	if err != nil {
+		return ""
+	}
+	if data, err := ioutil.ReadFile(path + ".digest"); err == nil {
+		for _, line := range strings.Split(string(data), "\n") {
+			// algorithm, hash, size and modification time in nanoseconds
+			if f := strings.Fields(line); len(f) == 4 && f[0] == algo &&
+				f[2] == strconv.FormatInt(st.Size(), 10) && f[3] == strconv.FormatInt(st.ModTime().UnixNano(), 10) {
+				return f[1]
+			}
+		}
+	}
+
+	file, err := os.Open(path)
+	if err != nil {
+		return ""
+	}
+	defer file.Close()
+	h := digests[algo]()
+	if _, err := io.Copy(h, file); err != nil {
+		return ""
+	}
+	sum := fmt.Sprintf("%x", h.Sum(nil))
+	log.Check(log.DebugLevel, "Saving digest of "+path, saveDigest(path, algo, sum))
+	return sum
+}
+
+// cacheAdd saves the hash of verified archive and adds the archive to the index of tmpdir.
+// Archive is served to other resource hosts if shared is set, see template.CacheAdd.
+func cacheAdd(path, name, algo, sum string, shared bool) {
+	log.Check(log.DebugLevel, "Saving digest of "+path, saveDigest(path, algo, sum))
+	template.CacheAdd(path, name, sum, shared)
+}
+
+// saveDigest stores hash sum of the file for fileDigest.
+func saveDigest(path, algo, sum string) error {
+	st, err := os.Stat(path)
+	if err != nil {
+		return err
+	}
+	line := algo + " " + sum + " " + strconv.FormatInt(st.Size(), 10) + " " + strconv.FormatInt(st.ModTime().UnixNano(), 10) + "\n"
+	return ioutil.WriteFile(path+".digest", []byte(line), 0644)
+}
+
+// checkLocal reads content of local templates folder to check if required archive is present there.
+// Archives are looked up in the index by hash, folder is scanned only for archives missing in the index.
 func checkLocal(t *templ) bool {
 	var response string
+	sum, algo := idHash(t.id)
+	if len(t.id) != 0 && len(algo) != 0 {
+		if file := template.CacheGet(sum); len(file) != 0 && sum == fileDigest(config.Agent.LxcPrefix+"tmpdir/"+file, algo) {
+			t.file = file
+			return true
+		}
+	}
 	files, _ := ioutil.ReadDir(config.Agent.LxcPrefix + "tmpdir")
 	for _, f := range files {
-		if strings.HasPrefix(f.Name(), t.name+"-subutai-template") {
+		if strings.HasPrefix(f.Name(), t.name+"-subutai-template") && strings.HasSuffix(f.Name(), ".tar.gz") {
 			if len(t.id) == 0 {
 				fmt.Print("Cannot verify local template. Trust anyway? (y/n)")
 				_, err := fmt.Scanln(&response)
@@ -129,7 +211,9 @@ func checkLocal(t *templ) bool {
 				}
 				return false
 			}
-			if id := strings.Split(t.id, "."); len(id) > 0 && id[len(id)-1] == md5sum(config.Agent.LxcPrefix+"tmpdir/"+f.Name()) {
+			if len(algo) != 0 && sum == fileDigest(config.Agent.LxcPrefix+"tmpdir/"+f.Name(), algo) {
+				t.file = f.Name()
+				cacheAdd(config.Agent.LxcPrefix+"tmpdir/"+f.Name(), t.name, algo, sum, false)
 				return true
 			}
 		}
@@ -137,15 +221,13 @@ func checkLocal(t *templ) bool {
 	return false
 }
 
-// download gets template archive from global repository
-func download(t templ, kurjun *http.Client, token string, torrent bool) bool {
+// download gets template archive from global repository. Templates downloaded directly from the repository are deployed
+// while they are downloaded, see stream, installed is true in that case. Archive is stored if streaming fails in the middle,
+// the next import continues downloading it instead of streaming.
+func download(t templ, kurjun *http.Client, token string, torrent bool) (ok, installed bool) {
 	if len(t.id) == 0 {
-		return false
+		return false, false
 	}
-	out, err := os.Create(config.Agent.LxcPrefix + "tmpdir/" + t.file)
-	log.Check(log.FatalLevel, "Creating file "+t.file, err)
-	defer out.Close()
-
 	url := config.CDN.Kurjun + "/template/download?id=" + t.id
 
 	if torrent {
@@ -153,10 +235,10 @@ func download(t templ, kurjun *http.Client, token string, torrent bool) bool {
 	} else if len(t.owner) > 0 {
 		url = config.CDN.Kurjun + "/template/" + t.owner[0] + "/" + t.file
 	}
-	response, err := kurjun.Get(url)
-	log.Check(log.FatalLevel, "Getting "+url, err)
 
-	if torrent && response.StatusCode == http.StatusAccepted {
+	if torrent {
+		response, err := kurjun.Get(url)
+		log.Check(log.FatalLevel, "Getting "+url, err)
 		var bar *pb.ProgressBar
 		for ; response.StatusCode == http.StatusAccepted; response, _ = kurjun.Get(url) {
 			body, err := ioutil.ReadAll(response.Body)
@@ -171,41 +253,39 @@ func download(t templ, kurjun *http.Client, token string, torrent bool) bool {
 			bar.Set(t.Done)
 			time.Sleep(time.Second)
 		}
-		bar.Update()
-		_, err = io.Copy(out, response.Body)
 		response.Body.Close()
-	} else {
-		defer response.Body.Close()
-		bar := pb.New(int(response.ContentLength)).SetUnits(pb.U_BYTES)
-		bar.Start()
-		rd := bar.NewProxyReader(response.Body)
-		_, err = io.Copy(out, rd)
-
-		for c := 0; err != nil && c < 5; _, err = io.Copy(out, rd) {
-			log.Info("Download interrupted, retrying")
-			time.Sleep(3 * time.Second)
-			c++
-
-			//Repeating GET request to CDN, while need to continue interrupted download
-			out, err = os.Create(config.Agent.LxcPrefix + "tmpdir/" + t.file)
-			log.Check(log.FatalLevel, "Creating file "+t.file, err)
-			defer out.Close()
-			response, err = kurjun.Get(url)
-			log.Check(log.FatalLevel, "Getting "+url, err)
-			defer response.Body.Close()
-			bar = pb.New(int(response.ContentLength)).SetUnits(pb.U_BYTES)
-			bar.Start()
-			rd = bar.NewProxyReader(response.Body)
+		if bar != nil {
+			bar.Update()
 		}
-		log.Check(log.FatalLevel, "Writing response body to file", err)
+	} else if err := stream(t, kurjun, url, token, torrent); err == nil {
+		return true, true
+	} else if _, ok := err.(httpError); ok {
+		log.Debug("Getting " + url + ": " + err.Error())
+		return false, false
+	} else if err == errResume {
+		log.Info("Resuming download of " + t.file)
+	} else {
+		log.Warn("Streaming import failed, downloading archive: " + err.Error())
+	}
+
+	sum, algo := idHash(t.id)
+	if len(algo) == 0 {
+		log.Warn("Unknown hash of template id " + t.id)
+		return false, false
+	}
+	path := config.Agent.LxcPrefix + "tmpdir/" + t.file
+	h := digests[algo]()
+	if log.Check(log.WarnLevel, "Downloading "+url, fetch(kurjun, url, path, h, false)) {
+		return false, false
 	}
 
 	time.Sleep(time.Millisecond * 300) // Added sleep to prevent output collision with progress bar.
 
-	if id := strings.Split(t.id, "."); len(id) > 0 && id[len(id)-1] == md5sum(config.Agent.LxcPrefix+"tmpdir/"+t.file) {
-		return true
+	if sum != fmt.Sprintf("%x", h.Sum(nil)) {
+		return false, false
 	}
-	return false
+	cacheAdd(path, t.name, algo, sum, !torrent)
+	return true, false
 }
 
 // idToName retrieves template name from global repository by passed id string
@@ -267,6 +347,7 @@ func unlockSubutai() {
 //
 // If Internet access is lost, or it is not possible to upload custom templates to the repository, the filesystem path `/mnt/lib/lxc/tmpdir/` could be used as local repository;
 // the import sub command checks this directory if a requested published template or the global repository is not available.
+// Templates are downloaded from other resource hosts in the local network first, if they share their caches with `share = true` in [cdn] section.
 //
 // The import binding handles security checks to confirm the authenticity and integrity of templates. Besides using strict SSL connections for downloads,
 // it verifies the fingerprint and its checksum for each template: an MD5 hash sum signed with author's GPG key. Import executes different integrity and authenticity checks of the template
@@ -364,40 +445,62 @@ func LxcImport(name, version, token string, torrent bool) {
 		// }
 	}
 
+	if kurjun != nil && len(t.id) != 0 && !torrent {
+		prefetch(t, kurjun, token)
+	}
+
+	downloaded, installed := false, false
 	if !checkLocal(&t) {
 		log.Info("Downloading " + t.name)
-		downloaded := false
-		if len(t.owner) == 0 {
+		if len(t.id) != 0 && !torrent {
+			downloaded = fromPeers(t)
+		}
+		if !downloaded && len(t.owner) == 0 {
 			for _, owner := range owners {
 				if t.owner = []string{owner}; len(owner) == 0 {
 					t.owner = []string{}
 				}
-				if download(t, kurjun, token, torrent) {
-					downloaded = true
+				if downloaded, installed = download(t, kurjun, token, torrent); downloaded {
 					break
 				}
 			}
 		}
-		if !downloaded && !download(t, kurjun, token, torrent) {
+		if !downloaded {
+			downloaded, installed = download(t, kurjun, token, torrent)
+		}
+		if !downloaded {
 			log.Error("Failed to download or verify template " + t.name)
 		} else {
 			log.Info("File integrity verified")
 		}
 	}
 
-	log.Info("Unpacking template " + t.name)
-	log.Debug(config.Agent.LxcPrefix + "tmpdir/ " + t.file + " to " + t.name)
-	tgz := extractor.NewTgz()
-	templdir := config.Agent.LxcPrefix + "tmpdir/" + t.name
-	log.Check(log.FatalLevel, "Extracting tgz", tgz.Extract(config.Agent.LxcPrefix+"tmpdir/"+t.file, templdir))
-	parent := container.GetConfigItem(templdir+"/config", "subutai.parent")
-	if parent != "" && parent != t.name && !container.IsTemplate(parent) {
-		log.Info("Parent template required: " + parent)
-		LxcImport(parent, "", token, torrent)
+	archive := config.Agent.LxcPrefix + "tmpdir/" + t.file
+	for !installed {
+		log.Info("Unpacking template " + t.name)
+		log.Debug(archive + " to " + t.name)
+		f, err := os.Open(archive)
+		log.Check(log.FatalLevel, "Opening "+archive, err)
+		parent, err := deploy(t.name, f)
+		f.Close()
+		if err == errParent {
+			rollback(t.name)
+			log.Info("Parent template required: " + parent)
+			LxcImport(parent, "", token, torrent)
+			continue
+		}
+		if err != nil {
+			rollback(t.name)
+			log.Error("Unpacking template " + t.name + ": " + err.Error())
+		}
+		installed = true
+	}
+	if (downloaded || prefetched[t.file]) && !config.CDN.Cache {
+		template.CacheDel(t.file)
 	}
 
-	log.Info("Installing template " + t.name)
-	template.Install(parent, t.name)
+	templdir := config.Agent.LxcPrefix + "tmpdir/" + t.name
+	template.Configure(t.name)
 	// TODO following lines kept for back compatibility with old templates, should be deleted when all templates will be replaced.
 	os.Rename(config.Agent.LxcPrefix+t.name+"/"+t.name+"-home", config.Agent.LxcPrefix+t.name+"/home")
 	os.Rename(config.Agent.LxcPrefix+t.name+"/"+t.name+"-var", config.Agent.LxcPrefix+t.name+"/var")
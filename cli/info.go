@@ -19,6 +19,7 @@ import (
 	"github.com/subutai-io/agent/config"
 	"github.com/subutai-io/agent/lib/container"
 	"github.com/subutai-io/agent/lib/fs"
+	"github.com/subutai-io/agent/lib/gpg"
 	"github.com/subutai-io/agent/lib/net"
 	"github.com/subutai-io/agent/log"
 )
@@ -296,9 +297,16 @@ func Info(command, host, interval string) {
 		fmt.Println(net.GetIp())
 		return
 	} else if command == "ports" {
-		for k := range usedPorts() {
-			fmt.Println(k)
+		for proto, ports := range net.Listeners(false) {
+			for port := range ports {
+				fmt.Println(proto + ":" + strconv.Itoa(port))
+			}
 		}
+		return
+	} else if command == "keypool" {
+		ready, size := gpg.KeyPoolStatus()
+		fmt.Printf("ready: %d\nsize: %d\nworkers: %d\n", ready, size, config.Agent.KeyPoolWorkers)
+		return
 	}
 
 	initdb()
@@ -318,20 +326,3 @@ func Info(command, host, interval string) {
 		fmt.Println(sysLoad(host))
 	}
 }
-
-func usedPorts() map[string]bool {
-	ports := make(map[string]bool)
-
-	out, _ := exec.Command("netstat", "-ltun").Output()
-	scanner := bufio.NewScanner(bytes.NewReader(out))
-
-	for scanner.Scan() {
-		line := strings.Fields(scanner.Text())
-		if len(line) > 4 && (strings.HasPrefix(line[0], "tcp") || strings.HasPrefix(line[0], "udp")) {
-			if socket := strings.Split(line[3], ":"); len(socket) > 1 && socket[0] != "127.0.0.1" {
-				ports[strings.TrimSuffix(line[0], "6")+":"+socket[len(socket)-1]] = true
-			}
-		}
-	}
-	return ports
-}
@@ -7,10 +7,8 @@ import (
 	"strings"
 	"text/tabwriter"
 
-	"github.com/subutai-io/agent/config"
 	"github.com/subutai-io/agent/lib/container"
 	"github.com/subutai-io/agent/log"
-	lxc "gopkg.in/lxc/go-lxc.v2"
 )
 
 // printHeader prints list headerline
@@ -56,12 +54,13 @@ func printList(list []string, c, t, i, a, p bool) {
 func LxcList(name string, c, t, i, a, p bool) {
 	list := []string{}
 	if i {
+		names := []string{name}
 		if name == "" {
-			for _, item := range container.Containers() {
-				list = append(list, info(item)...)
-			}
-		} else {
-			list = append(list, info(name)...)
+			names = container.Containers()
+		}
+		states := container.States(names)
+		for _, item := range names {
+			list = append(list, info(item, states[item])...)
 		}
 	} else if c == t {
 		list = append(list, container.All()...)
@@ -116,14 +115,15 @@ func addAncestors(list []string) []string {
 }
 
 // info adds container's IP and NIC to list
-func info(name string) (result []string) {
-	c, err := lxc.NewContainer(name, config.Agent.LxcPrefix)
+func info(name, state string) (result []string) {
+	c, err := container.Acquire(name)
 	log.Check(log.FatalLevel, "Looking for container "+name, err)
+	defer container.Release(c)
 
 	nic := "eth0"
 
 	listip, _ := c.IPAddress(nic)
 	ip := strings.Join(listip, " ")
 
-	return append(result, name+"\t"+container.State(name)+"\t"+ip+"\t"+nic)
+	return append(result, name+"\t"+state+"\t"+ip+"\t"+nic)
 }
@@ -2,18 +2,16 @@ package cli
 
 import (
 	"io/ioutil"
-	"math/rand"
 	"net"
 	"os"
 	"strconv"
 	"strings"
-	"time"
 
 	"github.com/subutai-io/agent/config"
 	"github.com/subutai-io/agent/db"
-	"github.com/subutai-io/agent/lib/fs"
 	"github.com/subutai-io/agent/lib/gpg"
 	ovs "github.com/subutai-io/agent/lib/net"
+	"github.com/subutai-io/agent/lib/nginx"
 	"github.com/subutai-io/agent/log"
 )
 
@@ -37,22 +35,20 @@ func MapPort(protocol, internal, external, policy, domain, cert string, remove b
 		internal != "10.10.10.1:"+external {
 		log.Error("Reserved system ports")
 	} else if len(internal) != 0 {
-		// check external port and create nginx config
-		if portIsNew(protocol, internal, domain, &external) {
-			newConfig(protocol, external, domain, cert)
+		// check external port and install certificate of new https mapping
+		if portIsNew(protocol, internal, domain, &external) && protocol == "https" {
+			writeMapCert(external, cert)
 		}
 
-		// add containers to backend
-		addLine(config.Agent.DataPrefix+"nginx-includes/"+protocol+"/"+external+".conf",
-			"#Add new host here", "	server "+internal+";", false)
-
-		// save information to database
+		// save information to database and render nginx config from it
 		saveMapToDB(protocol, internal, external, domain)
 		balanceMethod(protocol, external, policy)
+		writeMap(protocol, external)
 
 		log.Info(ovs.GetIp() + ":" + external)
 	} else if len(policy) != 0 {
 		balanceMethod(protocol, external, policy)
+		writeMap(protocol, external)
 	}
 	// reload nginx
 	restart()
@@ -65,46 +61,32 @@ func mapRemove(protocol, internal, external string) {
 	if !bolt.PortInMap(protocol, external, internal) {
 		return
 	}
-	l := bolt.PortMapDelete(protocol, internal, external)
 
-	if l > 0 {
-		if strings.Contains(internal, ":") {
-			internal = internal + ";"
-		} else {
-			internal = internal + ":"
+	if l := bolt.PortMapDelete(protocol, internal, external); l <= 0 {
+		bolt.PortMapDelete(protocol, "", external)
+		if port, err := strconv.Atoi(external); err == nil {
+			log.Check(log.WarnLevel, "Releasing port "+external, bolt.ReleasePort(protocol, port))
 		}
-		addLine(config.Agent.DataPrefix+"nginx-includes/"+protocol+"/"+external+".conf",
-			"server "+internal, " ", true)
-	} else {
-		os.Remove(config.Agent.DataPrefix + "nginx-includes/" + protocol + "/" + external + ".conf")
 		if protocol == "https" {
-			os.Remove(config.Agent.DataPrefix + "web/ssl/https-" + external + ".key")
-			os.Remove(config.Agent.DataPrefix + "web/ssl/https-" + external + ".crt")
+			os.Remove(nginx.CertPath(external) + ".key")
+			os.Remove(nginx.CertPath(external) + ".crt")
 		}
 	}
+	// config of the mapping without backends is removed
+	log.Check(log.WarnLevel, "Writing port map config", nginx.WriteMap(bolt.PortMapping(protocol, external)))
 }
 
-func isFree(protocol, port string) (res bool) {
-	switch protocol {
-	case "tcp", "http", "https":
-		if ln, err := net.Listen("tcp", ovs.GetIp()+":"+port); err == nil {
-			ln.Close()
-			res = true
-		}
-	case "udp":
-		if addr, err := net.ResolveUDPAddr("udp", ovs.GetIp()+":"+port); err == nil {
-			if ln, err := net.ListenUDP("udp", addr); err == nil {
-				ln.Close()
-				res = true
-			}
-		}
+// socketProto returns the protocol of the sockets nginx listens on for the mapping.
+func socketProto(protocol string) string {
+	if protocol == "udp" {
+		return protocol
 	}
-	return
+	return "tcp"
 }
 
-func random(min, max int) int {
-	rand.Seed(time.Now().Unix())
-	return rand.Intn(max-min) + min
+// isFree checks that no socket of the host listens on the port.
+func isFree(protocol string, port int) bool {
+	return !ovs.Listeners(true)[socketProto(protocol)][port]
 }
 
 func validSocket(socket string) bool {
@@ -119,131 +101,68 @@ func validSocket(socket string) bool {
 }
 
 func portIsNew(protocol, internal, domain string, external *string) (new bool) {
+	bolt, err := db.New()
+	log.Check(log.ErrorLevel, "Openning portmap database to read existing mappings", err)
+	defer bolt.Close()
+
 	if len(*external) != 0 {
-		if port, err := strconv.Atoi(*external); err != nil || port < 1000 || port > 65536 {
-			log.Error("Parameter \"external\" should be integer in range of 1000-65536")
+		port, err := strconv.Atoi(*external)
+		if err != nil || port < 1000 || port > 65535 {
+			log.Error("Parameter \"external\" should be integer in range of 1000-65535")
 		}
-		if isFree(protocol, *external) {
-			new = true
-		} else {
-			bolt, err := db.New()
-			log.Check(log.ErrorLevel, "Openning portmap database to read existing mappings", err)
-			if bolt.PortInMap(protocol, *external, internal) {
-				log.Error("Map is already exists")
-			} else if !bolt.PortInMap(protocol, *external, "") {
+		if bolt.PortInMap(protocol, *external, internal) {
+			log.Error("Map is already exists")
+		} else if !bolt.PortInMap(protocol, *external, "") {
+			if !isFree(protocol, port) {
 				log.Error("Port is busy")
 			}
-			log.Check(log.WarnLevel, "Closing database", bolt.Close())
+			log.Check(log.ErrorLevel, "Reserving port "+*external, bolt.ReservePort(protocol, []int{port}))
+			new = true
 		}
 	} else {
-		for *external = strconv.Itoa(random(1000, 65536)); !isFree(protocol, *external); *external = strconv.Itoa(random(1000, 65536)) {
-			continue
-		}
+		port, err := bolt.AllocPort(protocol, ovs.Listeners(true)[socketProto(protocol)])
+		log.Check(log.ErrorLevel, "Allocating external port", err)
+		*external = strconv.Itoa(port)
 		new = true
 	}
 	return
 }
 
-func newConfig(protocol, port, domain, cert string) {
-	log.Check(log.WarnLevel, "Creating nginx include folder",
-		os.MkdirAll(config.Agent.DataPrefix+"nginx-includes/"+protocol, 0755))
-
-	switch protocol {
-	case "https":
-		log.Check(log.ErrorLevel, "Creating certificate dirs", os.MkdirAll(config.Agent.DataPrefix+"/web/ssl/", 0755))
-		fs.Copy(config.Agent.AppPrefix+"etc/nginx/tmpl/vhost-ssl.example",
-			config.Agent.DataPrefix+"nginx-includes/"+protocol+"/"+port+".conf")
-		addLine(config.Agent.DataPrefix+"nginx-includes/"+protocol+"/"+port+".conf",
-			"listen      80;", "	listen "+port+";", true)
-		addLine(config.Agent.DataPrefix+"nginx-includes/"+protocol+"/"+port+".conf",
-			"listen	443;", "	listen "+port+";", true)
-		addLine(config.Agent.DataPrefix+"nginx-includes/"+protocol+"/"+port+".conf",
-			"server_name DOMAIN;", "server_name "+domain+";", true)
-		addLine(config.Agent.DataPrefix+"nginx-includes/"+protocol+"/"+port+".conf",
-			"proxy_pass http://DOMAIN-upstream/;", "	proxy_pass http://https-"+port+";", true)
-		addLine(config.Agent.DataPrefix+"nginx-includes/"+protocol+"/"+port+".conf",
-			"upstream DOMAIN-upstream {", "upstream https-"+port+" {", true)
-
-		crt, key := gpg.ParsePem(cert)
-		log.Check(log.WarnLevel, "Writing certificate body", ioutil.WriteFile(config.Agent.DataPrefix+"web/ssl/https-"+port+".crt", crt, 0644))
-		log.Check(log.WarnLevel, "Writing key body", ioutil.WriteFile(config.Agent.DataPrefix+"web/ssl/https-"+port+".key", key, 0644))
+// writeMapCert installs certificate and key of https port mapping
+func writeMapCert(port, cert string) {
+	log.Check(log.ErrorLevel, "Creating certificate dirs", os.MkdirAll(config.Agent.DataPrefix+"web/ssl/", 0755))
+	crt, key := gpg.ParsePem(cert)
+	log.Check(log.WarnLevel, "Writing certificate body", ioutil.WriteFile(nginx.CertPath(port)+".crt", crt, 0644))
+	log.Check(log.WarnLevel, "Writing key body", ioutil.WriteFile(nginx.CertPath(port)+".key", key, 0644))
+}
 
-		addLine(config.Agent.DataPrefix+"nginx-includes/"+protocol+"/"+port+".conf",
-			"ssl_certificate /var/snap/subutai/current/web/ssl/UNIXDATE.crt;",
-			"ssl_certificate "+config.Agent.DataPrefix+"web/ssl/https-"+port+".crt;", true)
-		addLine(config.Agent.DataPrefix+"nginx-includes/"+protocol+"/"+port+".conf",
-			"ssl_certificate_key /var/snap/subutai/current/web/ssl/UNIXDATE.key;",
-			"ssl_certificate_key "+config.Agent.DataPrefix+"web/ssl/https-"+port+".key;", true)
-	case "http":
-		fs.Copy(config.Agent.AppPrefix+"etc/nginx/tmpl/vhost.example",
-			config.Agent.DataPrefix+"nginx-includes/"+protocol+"/"+port+".conf")
-		addLine(config.Agent.DataPrefix+"nginx-includes/"+protocol+"/"+port+".conf",
-			"listen 	80;", "	listen "+port+";", true)
-		addLine(config.Agent.DataPrefix+"nginx-includes/"+protocol+"/"+port+".conf",
-			"server_name DOMAIN;", "server_name "+domain+";", true)
-		addLine(config.Agent.DataPrefix+"nginx-includes/"+protocol+"/"+port+".conf",
-			"proxy_pass http://DOMAIN-upstream/;", "	proxy_pass http://http-"+port+";", true)
-		addLine(config.Agent.DataPrefix+"nginx-includes/"+protocol+"/"+port+".conf",
-			"upstream DOMAIN-upstream {", "upstream http-"+port+" {", true)
-	case "tcp":
-		fs.Copy(config.Agent.AppPrefix+"etc/nginx/tmpl/stream.example",
-			config.Agent.DataPrefix+"nginx-includes/"+protocol+"/"+port+".conf")
-		addLine(config.Agent.DataPrefix+"nginx-includes/"+protocol+"/"+port+".conf",
-			"listen PORT;", "	listen "+port+";", true)
-	case "udp":
-		fs.Copy(config.Agent.AppPrefix+"etc/nginx/tmpl/stream.example",
-			config.Agent.DataPrefix+"nginx-includes/"+protocol+"/"+port+".conf")
-		addLine(config.Agent.DataPrefix+"nginx-includes/"+protocol+"/"+port+".conf",
-			"listen PORT;", "	listen "+port+" udp;", true)
-	}
-	addLine(config.Agent.DataPrefix+"nginx-includes/"+protocol+"/"+port+".conf",
-		"server localhost:81;", " ", true)
-	addLine(config.Agent.DataPrefix+"nginx-includes/"+protocol+"/"+port+".conf",
-		"upstream PROTO-PORT {", "upstream "+protocol+"-"+port+" {", true)
-	addLine(config.Agent.DataPrefix+"nginx-includes/"+protocol+"/"+port+".conf",
-		"proxy_pass PROTO-PORT;", "	proxy_pass "+protocol+"-"+port+";", true)
+// writeMap renders nginx config of the port mapping from the database
+func writeMap(protocol, port string) {
+	bolt, err := db.New()
+	log.Check(log.ErrorLevel, "Openning portmap database to render config", err)
+	m := bolt.PortMapping(protocol, port)
+	log.Check(log.WarnLevel, "Closing database", bolt.Close())
+	log.Check(log.ErrorLevel, "Writing port map config", nginx.WriteMap(m))
 }
 
 func balanceMethod(protocol, port, policy string) {
-	replaceString := "upstream " + protocol + "-" + port + " {"
-	replace := false
 	bolt, err := db.New()
 	log.Check(log.ErrorLevel, "Openning portmap database to check if port is mapped", err)
+	defer bolt.Close()
 	if !bolt.PortInMap(protocol, port, "") {
 		log.Error("Port is not mapped")
 	}
-	if p := bolt.GetMapMethod(protocol, port); len(p) != 0 && p != policy {
-		replaceString = "; #policy"
-		replace = true
-	} else if p == policy {
+	if len(policy) == 0 || bolt.GetMapMethod(protocol, port) == policy {
 		return
 	}
-	log.Check(log.WarnLevel, "Saving map method", bolt.SetMapMethod(protocol, port, policy))
-	log.Check(log.WarnLevel, "Closing database", bolt.Close())
-
-	switch policy {
-	case "round-robin":
-		policy = "#round-robin"
-	//  "least_conn":
-	case "least_time":
-		if protocol == "tcp" {
-			policy = policy + " connect"
-		} else {
-			policy = policy + " header"
-		}
-	case "hash":
-		policy = policy + " $remote_addr"
-	case "ip_hash":
-		if protocol != "http" {
-			log.Warn("ip_hash policy allowed only for http protocol")
-			return
-		}
-	default:
+	if policy == "ip_hash" && protocol != "http" {
+		log.Warn("ip_hash policy allowed only for http protocol")
+		return
+	} else if len(nginx.MapPolicy(protocol, policy)) == 0 {
 		log.Warn("Unsupported balancing method \"" + policy + "\"")
 		return
 	}
-	addLine(config.Agent.DataPrefix+"nginx-includes/"+protocol+"/"+port+".conf",
-		replaceString, "	"+policy+"; #policy", replace)
+	log.Check(log.WarnLevel, "Saving map method", bolt.SetMapMethod(protocol, port, policy))
 }
 
 func saveMapToDB(protocol, internal, external, domain string) {
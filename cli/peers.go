@@ -0,0 +1,141 @@
+package cli
+
+import (
+	"fmt"
+	"io"
+	"net"
+	"net/http"
+	"os"
+	"time"
+
+	"github.com/subutai-io/agent/config"
+	"github.com/subutai-io/agent/db"
+	"github.com/subutai-io/agent/log"
+)
+
+const (
+	// maxPeerArchive limits downloads from other resource hosts if the repository doesn't report the size of archive
+	maxPeerArchive = 8 << 30
+)
+
+// errTooLarge is returned when a peer sends more than the expected size of archive, it's not retried.
+var errTooLarge = httpError("Response exceeds the size of template archive")
+
+// lan is the transport for downloads from other resource hosts, it gives up quickly on peers which are gone.
+var lan = &http.Transport{
+	DialContext:           (&net.Dialer{Timeout: 3 * time.Second}).DialContext,
+	ResponseHeaderTimeout: 5 * time.Second,
+}
+
+// sizeLimit is the transport refusing the responses with the data beyond max bytes of the file,
+// so unauthenticated peers can't fill tmpdir by streaming endlessly.
+type sizeLimit struct {
+	rt  http.RoundTripper
+	max int64
+}
+
+func (l *sizeLimit) RoundTrip(req *http.Request) (*http.Response, error) {
+	response, err := l.rt.RoundTrip(req)
+	if err != nil {
+		return nil, err
+	}
+	start := int64(0)
+	if response.StatusCode == http.StatusPartialContent {
+		var end, size int64
+		if _, err = fmt.Sscanf(response.Header.Get("Content-Range"), "bytes %d-%d/%d", &start, &end, &size); err != nil || size > l.max {
+			response.Body.Close()
+			return nil, errTooLarge
+		}
+	}
+	if response.ContentLength > l.max-start {
+		response.Body.Close()
+		return nil, errTooLarge
+	}
+	response.Body = &limitedBody{ReadCloser: response.Body, left: l.max - start}
+	return response, nil
+}
+
+// limitedBody fails reading after left bytes instead of returning EOF, as io.LimitReader does.
+type limitedBody struct {
+	io.ReadCloser
+	left int64
+}
+
+func (b *limitedBody) Read(p []byte) (int, error) {
+	if b.left <= 0 {
+		// one more byte tells the end of the body from the excess
+		n, err := b.ReadCloser.Read(make([]byte, 1))
+		if n > 0 {
+			return 0, errTooLarge
+		}
+		return 0, err
+	}
+	if int64(len(p)) > b.left {
+		p = p[:b.left]
+	}
+	n, err := b.ReadCloser.Read(p)
+	b.left -= int64(n)
+	return n, err
+}
+
+// peerClient returns the client for downloading the archive of the template from other resource hosts,
+// limited by the size of archive reported by the repository.
+func peerClient(t templ) *http.Client {
+	max := t.size
+	if max <= 0 {
+		max = maxPeerArchive
+	}
+	return &http.Client{Transport: &sizeLimit{rt: lan, max: max}}
+}
+
+// peers returns locations of template caches of resource hosts in the local network, discovered by the daemon.
+func peers() (list []string) {
+	c, err := db.Dial()
+	if err != nil {
+		return nil
+	}
+	defer c.Close()
+	log.Check(log.DebugLevel, "Getting template peers", c.Call("Peers.List", true, &list))
+	return list
+}
+
+// fromPeers downloads the archive of the template to tmpdir from the first resource host in the local network which has it.
+// Archive is installed from tmpdir only after its hash matches the template id, as peers are not authenticated.
+func fromPeers(t templ) bool {
+	sum, algo := idHash(t.id)
+	if len(algo) == 0 || len(t.file) == 0 {
+		return false
+	}
+	path := config.Agent.LxcPrefix + "tmpdir/" + t.file
+	if !fetchPeers(peers(), t, path, false) {
+		return false
+	}
+	cacheAdd(path, t.name, algo, sum, true)
+	return true
+}
+
+// fetchPeers downloads the archive from the first resource host in the local network which has it and verifies its hash.
+// Peers are found by unauthenticated discovery, so the download is aborted if a peer sends more than the archive size.
+// Quiet download doesn't print progress bar, it's used for concurrent downloads.
+func fetchPeers(list []string, t templ, path string, quiet bool) bool {
+	sum, algo := idHash(t.id)
+	if len(algo) == 0 {
+		return false
+	}
+	client := peerClient(t)
+	for _, peer := range list {
+		h := digests[algo]()
+		err := fetch(client, peer+sum, path, h, quiet)
+		if err == nil && sum == fmt.Sprintf("%x", h.Sum(nil)) {
+			log.Debug(t.name + " downloaded from " + peer)
+			return true
+		}
+		if err == nil {
+			log.Warn("Hash sum of " + t.file + " from " + peer + " doesn't match template id")
+			os.Remove(path)
+		} else {
+			log.Debug("Getting " + t.name + " from " + peer + ": " + err.Error())
+		}
+	}
+	return false
+}
@@ -0,0 +1,92 @@
+package cli
+
+import (
+	"fmt"
+	"os"
+	"strconv"
+	"text/tabwriter"
+
+	"github.com/nightlyone/lockfile"
+
+	"github.com/subutai-io/agent/db"
+	"github.com/subutai-io/agent/lib/container"
+	"github.com/subutai-io/agent/log"
+)
+
+// Pool manages warm pools of prepared clones of the templates.
+//
+// Standby clones are stopped containers with shifted UID map and default settings which are renamed
+// to the requested name by the clone command, so clone of the pooled template takes only
+// network and key setup. Option `-s` sets the number of standby clones kept for the template, zero disables the pool.
+// Option `-r` creates missing standby clones; the daemon runs it periodically with the lowest I/O priority.
+// Without options the command prints configured pools.
+func Pool(template, size string, refill bool) {
+	bolt, err := db.New()
+	log.Check(log.ErrorLevel, "Opening database", err)
+	pools := bolt.PoolList()
+
+	if len(size) != 0 {
+		n, err := strconv.Atoi(size)
+		if err != nil || n < 0 {
+			bolt.Close()
+			log.Error("Pool size should be a positive number")
+		}
+		if !container.IsTemplate(template) {
+			bolt.Close()
+			log.Error(template + " is not a template")
+		}
+		log.Check(log.ErrorLevel, "Saving pool size", bolt.PoolSet(template, n))
+		log.Check(log.WarnLevel, "Closing database", bolt.Close())
+		drain(template, n)
+		return
+	}
+	log.Check(log.WarnLevel, "Closing database", bolt.Close())
+
+	if refill {
+		lock, err := lockfile.New("/var/run/lock/subutai.pool")
+		if log.Check(log.DebugLevel, "Init pool lock", err) || log.Check(log.DebugLevel, "Locking pool", lock.TryLock()) {
+			return
+		}
+		defer lock.Unlock()
+
+		container.Purge()
+		for t, n := range pools {
+			if !container.IsTemplate(t) {
+				continue
+			}
+			for i := len(container.Standby(t)); i < n; i++ {
+				log.Debug("Prepared standby clone " + container.Prepare(t))
+			}
+		}
+		return
+	}
+
+	w := new(tabwriter.Writer)
+	w.Init(os.Stdout, 0, 8, 1, '\t', 0)
+	fmt.Fprintln(w, "TEMPLATE\tSIZE\tREADY")
+	fmt.Fprintln(w, "--------\t----\t-----")
+	for t, n := range pools {
+		fmt.Fprintf(w, "%s\t%d\t%d\n", t, n, len(container.Standby(t)))
+	}
+	w.Flush()
+}
+
+// drain destroys standby clones of the template exceeding the pool size.
+func drain(template string, size int) {
+	list := container.Standby(template)
+	for i := size; i < len(list); i++ {
+		container.Destroy(list[i])
+	}
+}
+
+// claim renames standby clone of the parent template to child. It returns false if the pool is empty.
+func claim(parent, child string) bool {
+	for _, name := range container.Standby(parent) {
+		if container.Rename(name, child) == nil {
+			LxcHostname(child, child)
+			log.Debug("Claimed standby clone " + name)
+			return true
+		}
+	}
+	return false
+}
@@ -0,0 +1,141 @@
+package cli
+
+import (
+	"archive/tar"
+	"bufio"
+	"fmt"
+	"io"
+	"net/http"
+	"os"
+	"path"
+	"strings"
+	"sync"
+
+	"github.com/subutai-io/agent/config"
+	"github.com/subutai-io/agent/lib/container"
+	"github.com/subutai-io/agent/lib/fs"
+	"github.com/subutai-io/agent/log"
+)
+
+// prefetched are archives downloaded by prefetch, they are removed after installation unless caching is enabled.
+var prefetched = make(map[string]bool)
+
+// prefetch downloads archives of missing ancestors of the template concurrently, so deep lineages are not downloaded level by level.
+// Templates are still installed parent first by LxcImport, which finds the downloaded archives in tmpdir.
+// The template itself is downloaded along with its ancestors, as it can't be deployed while downloading before they are installed.
+// Resource hosts in the local network sharing their template caches are asked before the repository.
+func prefetch(t templ, kurjun *http.Client, token string) {
+	list := ancestry(t, kurjun, token)
+	if len(list) == 0 {
+		return
+	}
+	var names []string
+	for _, a := range list {
+		names = append(names, a.name)
+	}
+	log.Info("Downloading ancestors of " + t.name + ": " + strings.Join(names, ", "))
+
+	lanPeers := peers()
+	var wg sync.WaitGroup
+	var mu sync.Mutex
+	for _, a := range append(list, t) {
+		if checkLocal(&a) {
+			continue
+		}
+		wg.Add(1)
+		go func(a templ) {
+			defer wg.Done()
+			sum, algo := idHash(a.id)
+			if len(algo) == 0 {
+				return
+			}
+			file := config.Agent.LxcPrefix + "tmpdir/" + a.file
+			if !fetchPeers(lanPeers, a, file, true) {
+				h := digests[algo]()
+				if log.Check(log.WarnLevel, "Downloading "+a.name, fetch(kurjun, config.CDN.Kurjun+"/template/download?id="+a.id, file, h, true)) {
+					return
+				}
+				if sum != fmt.Sprintf("%x", h.Sum(nil)) {
+					log.Warn("Hash sum of " + a.file + " doesn't match template id")
+					os.Remove(file)
+					return
+				}
+			}
+			cacheAdd(file, a.name, algo, sum, true)
+			mu.Lock()
+			prefetched[a.file] = true
+			mu.Unlock()
+			log.Info(a.name + " downloaded")
+		}(a)
+	}
+	wg.Wait()
+}
+
+// ancestry returns ancestors of the template which are not installed, closest parent first.
+// Parent is taken from repository metadata or, if the repository doesn't provide it, from template config.
+func ancestry(t templ, kurjun *http.Client, token string) (list []templ) {
+	seen := map[string]bool{t.name: true}
+	for {
+		parent := t.parent
+		if len(parent) == 0 {
+			parent = archiveParent(t, kurjun)
+		}
+		if len(parent) == 0 || seen[parent] || container.IsTemplate(parent) {
+			return list
+		}
+		seen[parent] = true
+
+		t = templ{name: parent, version: config.Template.Version, branch: config.Template.Branch}
+		t.file = t.name + "-subutai-template_" + t.version + "_" + config.Template.Arch + ".tar.gz"
+		templId(&t, kurjun, token)
+		if len(t.id) == 0 {
+			return list
+		}
+		list = append(list, t)
+	}
+}
+
+// archiveParent reads parent of the template from its config, which is the first file of the archive.
+// Archive is read from tmpdir if it's there, otherwise only the beginning of the archive is downloaded.
+func archiveParent(t templ, kurjun *http.Client) string {
+	var r io.Reader
+	if f, err := os.Open(config.Agent.LxcPrefix + "tmpdir/" + t.file); err == nil {
+		defer f.Close()
+		r = f
+	} else {
+		response, err := kurjun.Get(config.CDN.Kurjun + "/template/download?id=" + t.id)
+		if err != nil {
+			return ""
+		}
+		defer response.Body.Close()
+		if response.StatusCode != http.StatusOK {
+			return ""
+		}
+		r = response.Body
+	}
+
+	zr, err := fs.Decompress(r)
+	if err != nil {
+		return ""
+	}
+	defer zr.Close()
+	tr := tar.NewReader(zr)
+	for {
+		hdr, err := tr.Next()
+		if err != nil {
+			return ""
+		}
+		switch file := strings.TrimPrefix(path.Clean("/"+hdr.Name), "/"); {
+		case file == "config":
+			scanner := bufio.NewScanner(tr)
+			for scanner.Scan() {
+				if line := strings.SplitN(scanner.Text(), "=", 2); len(line) == 2 && strings.TrimSpace(line[0]) == "subutai.parent" {
+					return strings.TrimSpace(line[1])
+				}
+			}
+			return ""
+		case strings.HasPrefix(file, "deltas/"):
+			return ""
+		}
+	}
+}
@@ -4,25 +4,20 @@ import (
 	"fmt"
 	"io/ioutil"
 	"os"
-	"os/exec"
 	"strconv"
 	"strings"
 	"time"
 
 	"github.com/subutai-io/agent/config"
-	"github.com/subutai-io/agent/lib/fs"
+	"github.com/subutai-io/agent/db"
 	"github.com/subutai-io/agent/lib/gpg"
+	"github.com/subutai-io/agent/lib/nginx"
 	"github.com/subutai-io/agent/log"
 )
 
-var (
-	conftmpl = config.Agent.AppPrefix + "etc/nginx/tmpl/"
-	confinc  = config.Agent.DataPrefix + "nginx-includes/http/"
-)
-
 // The reverse proxy component in Subutai provides and easy way to assign domain name and forward HTTP(S) traffic to certain environment.
 // The proxy binding is used to manage Subutai reverse proxies.
-// Each proxy subcommand works with config patterns: adding, removing or checking certain lines, and reloading the proxy daemon if needed, etc.
+// Each proxy subcommand changes the domain configuration kept in the database, renders nginx config from it and requests the proxy reload.
 // The reverse proxy functionality supports three common load balancing strategies - round-robin, load based and "sticky" sessions.
 // It can also accept SSL certificates in .pem file format and install it for a domain.
 
@@ -34,21 +29,28 @@ func ProxyAdd(vlan, domain, node, policy, cert string) {
 		if isVlanExist(vlan) {
 			log.Error("Domain already exist")
 		}
-		addDomain(vlan, domain, cert)
+		p := db.Proxy{Vlan: vlan, Domain: domain}
+		if cert != "" && gpg.ValidatePem(cert) {
+			p.Cert = writeCert(cert)
+		}
 		switch policy {
-		case "rr":
-			setPolicy(vlan, "")
 		case "lb":
-			setPolicy(vlan, "least_conn;")
+			p.Policy = "least_conn;"
 		case "hash":
-			setPolicy(vlan, "ip_hash;")
+			p.Policy = "ip_hash;"
 		}
+		saveProxy(p)
 		restart()
 	} else if node != "" {
-		if isNodeExist(vlan, node) {
+		if !isVlanExist(vlan) {
+			log.Error("Domain does not exist")
+		}
+		p := loadProxy(vlan)
+		if isNodeExist(p, node) {
 			log.Error("Node is already in domain")
 		}
-		addNode(vlan, node)
+		p.Nodes = append(p.Nodes, node)
+		saveProxy(p)
 		restart()
 	}
 }
@@ -56,30 +58,28 @@ func ProxyAdd(vlan, domain, node, policy, cert string) {
 // ProxyDel checks what need to be removed - domain or node and pass args to required functions
 func ProxyDel(vlan, node string, domain bool) {
 	if isVlanExist(vlan) {
+		p := loadProxy(vlan)
 		if domain && node == "" {
-			delDomain(vlan)
+			delDomain(p)
 		}
 		if node != "" {
-			delNode(vlan, node)
+			delNode(p, node)
 		}
 		restart()
 	}
-	// else {
-	// 	os.Exit(1)
-	// }
 }
 
 // ProxyCheck exits with 0 code if domain or node is exists in specified vlan, otherwise exitcode is 1
 func ProxyCheck(vlan, node string, domain bool) {
 	if vlan != "" && domain {
-		if d := getDomain(vlan); d != "" {
+		if d := loadProxy(vlan).Domain; d != "" {
 			fmt.Println(d)
 			os.Exit(0)
 		} else {
 			os.Exit(1)
 		}
 	} else if vlan != "" && node != "" {
-		if isNodeExist(vlan, node) {
+		if isNodeExist(loadProxy(vlan), node) {
 			log.Info("Node is in domain")
 			os.Exit(0)
 		} else {
@@ -89,178 +89,106 @@ func ProxyCheck(vlan, node string, domain bool) {
 	}
 }
 
-// restart reloads nginx process
+// restart asks for nginx reload, the daemon coalesces reloads requested by concurrent commands
 func restart() {
-	log.Check(log.FatalLevel, "Reloading nginx",
-		exec.Command("nginx.sh", "-s", "reload").Run())
+	log.Check(log.FatalLevel, "Reloading nginx", nginx.Reload())
 }
 
-// addDomain creates new domain config from pattern and adjusts it
-func addDomain(vlan, domain, cert string) {
-	if _, err := os.Stat(confinc); os.IsNotExist(err) {
-		err := os.MkdirAll(confinc, 0755)
-		if err != nil {
-			log.Info("Cannot create nginx-include directory " + confinc)
-		}
-	}
-	if cert != "" && gpg.ValidatePem(cert) {
-		currentDT := strconv.Itoa(int(time.Now().Unix()))
-
-		if _, err := os.Stat(config.Agent.DataPrefix + "/web/ssl/"); os.IsNotExist(err) {
-			err := os.MkdirAll(config.Agent.DataPrefix+"/web/ssl/", 0755)
-			if err != nil {
-				log.Info("Cannot create ssl directory " + config.Agent.DataPrefix + "/web/ssl/")
-				os.Exit(1)
-			}
-		}
-		fs.Copy(conftmpl+"vhost-ssl.example", confinc+vlan+".conf")
-		crt, key := gpg.ParsePem(cert)
-		err := ioutil.WriteFile(config.Agent.DataPrefix+"web/ssl/"+currentDT+".crt", crt, 0644)
-		if err != nil {
-			log.Info("Cannot create crt file " + config.Agent.DataPrefix + "web/ssl/" + currentDT + ".crt")
-			os.Exit(1)
-		}
-		err = ioutil.WriteFile(config.Agent.DataPrefix+"web/ssl/"+currentDT+".key", key, 0644)
-		if err != nil {
-			log.Info("Cannot create key file " + config.Agent.DataPrefix + "web/ssl/" + currentDT + ".key")
-			os.Exit(1)
-		}
-		addLine(confinc+vlan+".conf", "ssl_certificate /var/snap/subutai/current/web/ssl/UNIXDATE.crt;",
-			"	ssl_certificate "+config.Agent.DataPrefix+"web/ssl/"+currentDT+".crt;", true)
-		addLine(confinc+vlan+".conf", "ssl_certificate /var/snap/subutai/current/web/ssl/UNIXDATE.key;",
-			"	ssl_certificate_key "+config.Agent.DataPrefix+"web/ssl/"+currentDT+".key;", true)
-	} else {
-		fs.Copy(conftmpl+"vhost.example", confinc+vlan+".conf")
-	}
-	addLine(confinc+vlan+".conf", "upstream DOMAIN-upstream {", "upstream "+domain+"-upstream {", true)
-	addLine(confinc+vlan+".conf", "server_name DOMAIN;", "	server_name "+domain+";", true)
-	addLine(confinc+vlan+".conf", "proxy_pass http://DOMAIN-upstream/;", "	proxy_pass http://"+domain+"-upstream/;", true)
+// writeCert saves certificate and key of the domain and returns their path without extension
+func writeCert(cert string) string {
+	path := config.Agent.DataPrefix + "web/ssl/" + strconv.Itoa(int(time.Now().Unix()))
+	log.Check(log.ErrorLevel, "Creating ssl directory", os.MkdirAll(config.Agent.DataPrefix+"web/ssl/", 0755))
+	crt, key := gpg.ParsePem(cert)
+	log.Check(log.ErrorLevel, "Creating crt file", ioutil.WriteFile(path+".crt", crt, 0644))
+	log.Check(log.ErrorLevel, "Creating key file", ioutil.WriteFile(path+".key", key, 0644))
+	return path
 }
 
-// addNode adds configuration lines to domain configuration
-func addNode(vlan, node string) {
-	delLine(confinc+vlan+".conf", "server localhost:81;")
-	addLine(confinc+vlan+".conf", "#Add new host here", "	server "+node+"; #$node", false)
+// saveProxy stores domain configuration in database and renders its config
+func saveProxy(p db.Proxy) {
+	bolt, err := db.New()
+	log.Check(log.ErrorLevel, "Opening database", err)
+	log.Check(log.ErrorLevel, "Saving domain", bolt.ProxySet(p))
+	log.Check(log.WarnLevel, "Closing database", bolt.Close())
+	log.Check(log.ErrorLevel, "Writing proxy config", nginx.WriteProxy(p))
 }
 
-// delDomain removes domain configuration file and all related stuff
-func delDomain(vlan string) {
-	// get and remove cert files
-	f, err := ioutil.ReadFile(confinc + vlan + ".conf")
-	if err != nil {
-		log.Fatal("Cannot read nginx virtualhost file:" + confinc + vlan + ".conf")
-	}
-	lines := strings.Split(string(f), "\n")
-	for _, v := range lines {
-		if strings.Contains(v, "ssl_certificate") || strings.Contains(v, "ssl_certificate_key") {
-			line := strings.Fields(v)
-			if len(line) > 1 {
-				os.Remove(strings.Trim(line[1], ";"))
-			}
+// loadProxy returns domain configuration of the vlan. Domains configured before
+// the database kept them are imported from their config files.
+func loadProxy(vlan string) db.Proxy {
+	bolt, err := db.New()
+	log.Check(log.ErrorLevel, "Opening database", err)
+	p := bolt.ProxyGet(vlan)
+	if len(p.Domain) == 0 {
+		if p = proxyFromConf(vlan); len(p.Domain) != 0 {
+			log.Check(log.WarnLevel, "Importing domain", bolt.ProxySet(p))
 		}
 	}
-
-	os.Remove(confinc + vlan + ".conf")
+	log.Check(log.WarnLevel, "Closing database", bolt.Close())
+	return p
 }
 
-// delNode removes node configuration entries from domain config
-func delNode(vlan, node string) {
-	delLine(confinc+vlan+".conf", "server "+node+"; #$node")
-	delLine(confinc+vlan+".conf", "server "+node+": #$node")
-	if nodeCount(vlan) == 0 {
-		addLine(confinc+vlan+".conf", "#Add new host here", "   server localhost:81;", false)
-	}
-}
-
-// getDomain returns domain name assigned to specified vlan
-func getDomain(vlan string) string {
-	f, err := ioutil.ReadFile(confinc + vlan + ".conf")
+// proxyFromConf parses domain configuration from existing config file
+func proxyFromConf(vlan string) db.Proxy {
+	p := db.Proxy{Vlan: vlan}
+	f, err := ioutil.ReadFile(nginx.ProxyPath(vlan))
 	if err != nil {
-		return ""
+		return p
 	}
-	lines := strings.Split(string(f), "\n")
-	for _, v := range lines {
-		if strings.Contains(v, "server_name") {
-			line := strings.Fields(v)
-			if len(line) > 1 {
-				return strings.Trim(line[1], ";")
+	for _, v := range strings.Split(string(f), "\n") {
+		line := strings.Fields(v)
+		switch {
+		case len(line) < 2:
+			if len(line) == 1 && (line[0] == "ip_hash;" || line[0] == "least_conn;") {
+				p.Policy = line[0]
 			}
+		case line[0] == "server_name":
+			p.Domain = strings.Trim(line[1], ";")
+		case line[0] == "ssl_certificate":
+			p.Cert = strings.TrimSuffix(strings.Trim(line[1], ";"), ".crt")
+		case line[0] == "server" && strings.Contains(v, "#$node"):
+			p.Nodes = append(p.Nodes, strings.Trim(line[1], ";"))
 		}
 	}
-	return ""
+	return p
 }
 
-// isVlanExist is true is domain was configured on specified vlan and false if not
-func isVlanExist(vlan string) bool {
-	if _, err := os.Stat(confinc + vlan + ".conf"); err == nil {
-		return true
-	} else {
-		return false
+// delDomain removes domain configuration and certificate files
+func delDomain(p db.Proxy) {
+	if len(p.Cert) != 0 {
+		os.Remove(p.Cert + ".crt")
+		os.Remove(p.Cert + ".key")
 	}
+	bolt, err := db.New()
+	log.Check(log.ErrorLevel, "Opening database", err)
+	log.Check(log.WarnLevel, "Removing domain", bolt.ProxyDel(p.Vlan))
+	log.Check(log.WarnLevel, "Closing database", bolt.Close())
+	log.Check(log.WarnLevel, "Removing proxy config", nginx.WriteProxy(db.Proxy{Vlan: p.Vlan}))
 }
 
-// isNodeExist is true if specified node belongs to vlan, otherwise it is false
-func isNodeExist(vlan, node string) bool {
-	return addLine(confinc+vlan+".conf", "server "+node+";", "", false)
-}
-
-// nodeCount returns the number of nodes assigned to domain on specified vlan
-func nodeCount(vlan string) int {
-	f, err := ioutil.ReadFile(confinc + vlan + ".conf")
-	if !log.Check(log.DebugLevel, "Cannot read file "+confinc+vlan+".conf", err) {
-		return strings.Count(string(f), "#$node")
+// delNode removes node from domain, node given without port removes all its ports
+func delNode(p db.Proxy, node string) {
+	var nodes []string
+	for _, n := range p.Nodes {
+		if n != node && !strings.HasPrefix(n, node+":") {
+			nodes = append(nodes, n)
+		}
 	}
-	return 0
+	p.Nodes = nodes
+	saveProxy(p)
 }
 
-// setPolicy configures load balance policy for domain on specified vlan
-func setPolicy(vlan, policy string) {
-	delLine(confinc+vlan+".conf", "ip_hash;")
-	delLine(confinc+vlan+".conf", "least_time header;")
-	addLine(confinc+vlan+".conf", "#Add new host here", "	"+policy, false)
+// isVlanExist is true is domain was configured on specified vlan and false if not
+func isVlanExist(vlan string) bool {
+	return len(loadProxy(vlan).Domain) != 0
 }
 
-// addLine adds, removes, replaces and checks if line exists in specified file
-func addLine(path, after, line string, replace bool) bool {
-	f, err := ioutil.ReadFile(path)
-	if !log.Check(log.DebugLevel, "Cannot read file "+path, err) {
-		lines := strings.Split(string(f), "\n")
-		for k, v := range lines {
-			if strings.Contains(v, after) {
-				if line != "" {
-					if replace {
-						log.Debug("Replacing " + lines[k] + " with " + line)
-						lines[k] = line
-					} else {
-						log.Debug("Adding " + line + " after " + lines[k])
-						lines[k] = after + "\n" + line
-					}
-				} else {
-					return true
-				}
-			}
+// isNodeExist is true if specified node belongs to domain, otherwise it is false
+func isNodeExist(p db.Proxy, node string) bool {
+	for _, n := range p.Nodes {
+		if n == node {
+			return true
 		}
-		str := strings.Join(lines, "\n")
-		log.Check(log.FatalLevel, "Writing new proxy config",
-			ioutil.WriteFile(path, []byte(str), 0744))
 	}
 	return false
 }
-
-// delLine removes specified line from file
-func delLine(path, line string) {
-	var lines2 []string
-	f, err := ioutil.ReadFile(path)
-	if !log.Check(log.DebugLevel, "Reading config "+path, err) {
-
-		lines := strings.Split(string(f), "\n")
-		for _, v := range lines {
-			if !strings.Contains(v, line) {
-				lines2 = append(lines2, v)
-			}
-		}
-		str := strings.Join(lines2, "\n")
-		log.Check(log.FatalLevel, "Writing new proxy config",
-			ioutil.WriteFile(path, []byte(str), 0744))
-	}
-}
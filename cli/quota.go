@@ -8,6 +8,7 @@ import (
 	"github.com/subutai-io/agent/db"
 	"github.com/subutai-io/agent/lib/container"
 	"github.com/subutai-io/agent/lib/fs"
+	"github.com/subutai-io/agent/lib/net"
 	"github.com/subutai-io/agent/log"
 )
 
@@ -16,6 +17,7 @@ import (
 //	cpuset, available cores
 //	ram, Mb
 //	network, Kbps
+//	vlan, Kbps, aggregate bandwidth of the environment, container name is replaced by its VLAN id
 //	rootfs/home/var/opt, Gb
 // The threshold value represents a percentage for each resource. Once resource consumption exceeds this threshold it triggers an alert.
 // The clone operation, sets no quotas and thresholds for new containers; quotas need to be configured with quota command after a clone operation.
@@ -28,6 +30,9 @@ func LxcQuota(name, res, size, threshold string) {
 	switch res {
 	case "network":
 		quota = container.QuotaNet(name, size)
+	case "vlan":
+		fmt.Println(`{"quota":"` + quotaVlan(name, size) + `"}`)
+		return
 	case "rootfs", "home", "var", "opt":
 		quota = fs.Quota(name+"/"+res, size)
 	case "disk":
@@ -53,6 +58,21 @@ func LxcQuota(name, res, size, threshold string) {
 	fmt.Println(`{"quota":"` + quota + `", "threshold":` + alert + `}`)
 }
 
+// quotaVlan sets network bandwidth shared by all containers of the environment, shaping the traffic of its gateway interface.
+func quotaVlan(vlan, size string) string {
+	if len(size) > 0 {
+		bolt, err := db.New()
+		log.Check(log.WarnLevel, "Opening database", err)
+		log.Check(log.WarnLevel, "Writing environment quota to database", bolt.VlanQuota(vlan, size))
+		log.Check(log.WarnLevel, "Closing database", bolt.Close())
+	}
+	quota := net.RateLimit("gw-"+vlan, size)
+	if len(quota) == 0 {
+		quota = "0"
+	}
+	return quota
+}
+
 // setQuotaThreshold sets threshold for quota alerts
 func setQuotaThreshold(name, resource, size string) {
 	if resource == "rootfs" || resource == "var" || resource == "opt" || resource == "home" {
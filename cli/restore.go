@@ -14,8 +14,6 @@ import (
 	"github.com/subutai-io/agent/lib/fs"
 	"github.com/subutai-io/agent/lib/template"
 	"github.com/subutai-io/agent/log"
-
-	"code.cloudfoundry.org/archiver/extractor"
 )
 
 // RestoreContainer restores a Subutai container to a snapshot at a specified timestamp if such a backup archive is available.
@@ -140,6 +138,5 @@ func position(slice []string, value string) int {
 
 // Unpack extract passed archive to directory
 func unpack(archive, dir string) {
-	tgz := extractor.NewTgz()
-	tgz.Extract(archive, dir)
+	log.Check(log.FatalLevel, "Extracting "+archive, fs.Untar(archive, dir))
 }
@@ -27,6 +27,10 @@ type agentConfig struct {
 	LxcPrefix   string
 	DataPrefix  string
 	GpgPassword string
+
+	KeyPoolSize    int
+	KeyPoolWorkers int
+	LoadWeights    bool
 }
 type managementConfig struct {
 	Host          string
@@ -49,11 +53,17 @@ type cdnConfig struct {
 	URL           string
 	SSLport       string
 	Kurjun        string
+	Connections   int
+	Cache         bool
+	Cachesize     int
+	Share         bool
 }
 type templateConfig struct {
-	Branch  string
-	Version string
-	Arch    string
+	Branch      string
+	Version     string
+	Arch        string
+	Compression string
+	Cores       int
 }
 type configFile struct {
 	Agent      agentConfig
@@ -71,6 +81,9 @@ const defaultConfig = `
 	appPrefix = /apps/subutai/current/
 	dataPrefix = /var/lib/apps/subutai/current/
 	lxcPrefix = /mnt/lib/lxc/
+	keyPoolSize = 5
+	keyPoolWorkers = 1
+	loadWeights = false
 
 	[management]
 	gpgUser =
@@ -84,6 +97,10 @@ const defaultConfig = `
     url = cdn.subut.ai
     sslport = 8338
     allowinsecure = false
+    connections = 4
+    cache = true
+    cachesize = 20480
+    share = false
 
 	[influxdb]
 	server =
@@ -95,6 +112,8 @@ const defaultConfig = `
 	version = 4.0.0
 	branch =
 	arch = amd64
+	compression = gzip
+	cores = 0
 `
 
 var (
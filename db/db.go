@@ -1,8 +1,9 @@
 package db
 
 import (
-	"bytes"
+	"net/rpc"
 	"strconv"
+	"time"
 
 	"github.com/boltdb/bolt"
 
@@ -16,19 +17,37 @@ var (
 	sshtunnels = []byte("sshtunnels")
 	containers = []byte("containers")
 	portmap    = []byte("portmap")
+	pools      = []byte("pools")
+	vlanquota  = []byte("vlanquota")
 )
 
 type Instance struct {
-	db *bolt.DB
+	db     *bolt.DB
+	client *rpc.Client
+	shared bool
 }
 
+// New returns database instance. Inside the daemon it is the handle opened by Serve,
+// commands started while the daemon is running forward their calls to it over the socket
+// and only without the daemon the database file is opened directly.
 func New() (*Instance, error) {
-	boltDB, err := bolt.Open(config.Agent.DataPrefix+"agent.db", 0600, nil)
+	if shared != nil {
+		return &Instance{db: shared, shared: true}, nil
+	}
+	if client, err := Dial(); err == nil {
+		return &Instance{client: client}, nil
+	}
+	return open()
+}
+
+func open() (*Instance, error) {
+	boltDB, err := bolt.Open(config.Agent.DataPrefix+"agent.db", 0600, &bolt.Options{Timeout: 10 * time.Second})
 	if err != nil {
 		return nil, err
 	}
 
-	if initdb(boltDB) != nil {
+	if err = initdb(boltDB); err != nil {
+		boltDB.Close()
 		return nil, err
 	}
 	return &Instance{db: boltDB}, nil
@@ -36,58 +55,121 @@ func New() (*Instance, error) {
 
 func initdb(db *bolt.DB) error {
 	return db.Update(func(tx *bolt.Tx) error {
-		for _, b := range [][]byte{uuidmap, sshtunnels, containers, portmap} {
+		rebuild := tx.Bucket(containerindex) == nil
+		seed := tx.Bucket(portbitmap) == nil
+		counter := tx.Bucket(uidnext) == nil
+		for _, b := range [][]byte{uuidmap, sshtunnels, containers, portmap, pools, containerindex, portindex, uidfree, uidnames, portbitmap, proxies, backends, vlanquota, uidnext} {
 			if _, err := tx.CreateBucketIfNotExists(b); err != nil {
 				return err
 			}
 		}
+		if rebuild {
+			if err := rebuildIndex(tx); err != nil {
+				return err
+			}
+		}
+		if counter {
+			if err := seedUID(tx); err != nil {
+				return err
+			}
+		}
+		if seed {
+			return seedPorts(tx)
+		}
 		return nil
 	})
 }
 
+// Close releases the instance. The handle shared by the daemon stays open.
 func (i *Instance) Close() error {
+	if i.client != nil {
+		return i.client.Close()
+	}
+	if i.shared {
+		return nil
+	}
 	return i.db.Close()
 }
 
 func (i *Instance) DelUuidEntry(name string) error {
+	if i.client != nil {
+		return i.call("DelUuidEntry", nil, name)
+	}
 	return i.db.Update(func(tx *bolt.Tx) error {
-		if b := tx.Bucket(uuidmap); b != nil {
-			b.ForEach(func(k, v []byte) error {
-				if string(v) == name {
-					return b.Put(k, []byte("#"))
-				}
-				return nil
-			})
+		for _, uid := range prefixKeys(tx.Bucket(uidnames), name+"\x00") {
+			if err := tx.Bucket(uuidmap).Put([]byte(uid), []byte("#")); err != nil {
+				return err
+			}
+			if err := tx.Bucket(uidfree).Put([]byte(uid), nil); err != nil {
+				return err
+			}
+			if err := tx.Bucket(uidnames).Delete(indexKey(name, uid)); err != nil {
+				return err
+			}
 		}
 		return nil
 	})
 }
 
 func (i *Instance) GetUuidEntry(name string) string {
-	var uuid []byte
-	i.db.Update(func(tx *bolt.Tx) error {
-		if b := tx.Bucket(uuidmap); b != nil {
-			if b.Stats().KeyN == 0 {
-				uuid = []byte("65536")
-			} else {
-				b.ForEach(func(k, v []byte) error {
-					if string(v) == "#" {
-						uuid = k
-					}
-					return nil
-				})
+	if i.client != nil {
+		var r string
+		i.call("GetUuidEntry", &r, name)
+		return r
+	}
+	var uuid string
+	err := i.db.Update(func(tx *bolt.Tx) error {
+		// released ranges are reused first
+		if k, _ := tx.Bucket(uidfree).Cursor().First(); k != nil {
+			uuid = string(k)
+			if err := tx.Bucket(uidfree).Delete(k); err != nil {
+				return err
 			}
-			if len(uuid) == 0 {
-				uuid = []byte(strconv.Itoa(65536 + 65536*b.Stats().KeyN))
+		} else {
+			uuid = string(tx.Bucket(uidnext).Get(nextKey))
+			next, err := strconv.Atoi(uuid)
+			if err != nil {
+				return err
+			}
+			if err = tx.Bucket(uidnext).Put(nextKey, []byte(strconv.Itoa(next+65536))); err != nil {
+				return err
+			}
+		}
+		if err := tx.Bucket(uuidmap).Put([]byte(uuid), []byte(name)); err != nil {
+			return err
+		}
+		return tx.Bucket(uidnames).Put(indexKey(name, uuid), nil)
+	})
+	if err != nil {
+		return ""
+	}
+	return uuid
+}
+
+func (i *Instance) RenameUuidEntry(src, dst string) error {
+	if i.client != nil {
+		return i.call("RenameUuidEntry", nil, src, dst)
+	}
+	return i.db.Update(func(tx *bolt.Tx) error {
+		for _, uid := range prefixKeys(tx.Bucket(uidnames), src+"\x00") {
+			if err := tx.Bucket(uuidmap).Put([]byte(uid), []byte(dst)); err != nil {
+				return err
+			}
+			if err := tx.Bucket(uidnames).Delete(indexKey(src, uid)); err != nil {
+				return err
+			}
+			if err := tx.Bucket(uidnames).Put(indexKey(dst, uid), nil); err != nil {
+				return err
 			}
-			b.Put(uuid, []byte(name))
 		}
 		return nil
 	})
-	return string(uuid)
 }
 
 func (i *Instance) AddTunEntry(options map[string]string) error {
+	if i.client != nil {
+		return i.call("AddTunEntry", nil, options)
+	}
 	return i.db.Update(func(tx *bolt.Tx) error {
 		if b := tx.Bucket(sshtunnels); b != nil {
 			if c, err := b.CreateBucketIfNotExists([]byte(options["pid"])); err == nil {
@@ -103,6 +185,9 @@ func (i *Instance) AddTunEntry(options map[string]string) error {
 }
 
 func (i *Instance) DelTunEntry(pid string) error {
+	if i.client != nil {
+		return i.call("DelTunEntry", nil, pid)
+	}
 	return i.db.Update(func(tx *bolt.Tx) error {
 		if b := tx.Bucket(sshtunnels); b != nil {
 			return b.DeleteBucket([]byte(pid))
@@ -112,6 +197,11 @@ func (i *Instance) DelTunEntry(pid string) error {
 }
 
 func (i *Instance) GetTunList() (list []map[string]string) {
+	if i.client != nil {
+		var r []map[string]string
+		i.call("GetTunList", &r)
+		return r
+	}
 	i.db.View(func(tx *bolt.Tx) error {
 		if b := tx.Bucket(sshtunnels); b != nil {
 			b.ForEach(func(k, v []byte) error {
@@ -135,6 +225,9 @@ func (i *Instance) GetTunList() (list []map[string]string) {
 
 // DiscoverySave stores information from auto discovery service in DB.
 func (i *Instance) DiscoverySave(ip string) error {
+	if i.client != nil {
+		return i.call("DiscoverySave", nil, ip)
+	}
 	return i.db.Update(func(tx *bolt.Tx) error {
 		if c, err := tx.CreateBucketIfNotExists([]byte("config")); err == nil {
 			if err := c.Put([]byte("DiscoveredIP"), []byte(ip)); err != nil {
@@ -147,6 +240,11 @@ func (i *Instance) DiscoverySave(ip string) error {
 
 // DiscoveryLoad returns information from auto discovery service stored in DB.
 func (i *Instance) DiscoveryLoad() (ip string) {
+	if i.client != nil {
+		var r string
+		i.call("DiscoveryLoad", &r)
+		return r
+	}
 	i.db.View(func(tx *bolt.Tx) error {
 		if b := tx.Bucket([]byte("config")); b != nil {
 			ip = string(b.Get([]byte("DiscoveredIP")))
@@ -157,8 +255,14 @@ func (i *Instance) DiscoveryLoad() (ip string) {
 }
 
 func (i *Instance) ContainerAdd(name string, options map[string]string) (err error) {
+	if i.client != nil {
+		return i.call("ContainerAdd", nil, name, options)
+	}
 	i.db.Update(func(tx *bolt.Tx) error {
 		if b := tx.Bucket(containers); b != nil {
+			if err = indexContainer(tx, name, options); err != nil {
+				return err
+			}
 			b, err = b.CreateBucketIfNotExists([]byte(name))
 			if err != nil {
 				return err
@@ -175,8 +279,14 @@ func (i *Instance) ContainerAdd(name string, options map[string]string) (err err
 }
 
 func (i *Instance) ContainerDel(name string) (err error) {
+	if i.client != nil {
+		return i.call("ContainerDel", nil, name)
+	}
 	i.db.Update(func(tx *bolt.Tx) error {
 		if b := tx.Bucket(containers); b != nil {
+			if err = unindexContainer(tx, name); err != nil {
+				return err
+			}
 			if err = b.DeleteBucket([]byte(name)); err != nil {
 				return err
 			}
@@ -187,6 +297,9 @@ func (i *Instance) ContainerDel(name string) (err error) {
 }
 
 func (i *Instance) ContainerQuota(name, res, quota string) (err error) {
+	if i.client != nil {
+		return i.call("ContainerQuota", nil, name, res, quota)
+	}
 	i.db.Update(func(tx *bolt.Tx) error {
 		if b := tx.Bucket(containers); b != nil {
 			if b = b.Bucket([]byte(name)); b != nil {
@@ -204,7 +317,60 @@ func (i *Instance) ContainerQuota(name, res, quota string) (err error) {
 	return err
 }
 
+// ContainerQuotas returns quotas of the container stored by ContainerQuota.
+func (i *Instance) ContainerQuotas(name string) map[string]string {
+	if i.client != nil {
+		var r map[string]string
+		i.call("ContainerQuotas", &r, name)
+		return r
+	}
+	list := make(map[string]string)
+	i.db.View(func(tx *bolt.Tx) error {
+		if b := tx.Bucket(containers).Bucket([]byte(name)); b != nil {
+			if b = b.Bucket([]byte("quota")); b != nil {
+				b.ForEach(func(k, v []byte) error {
+					list[string(k)] = string(v)
+					return nil
+				})
+			}
+		}
+		return nil
+	})
+	return list
+}
+
+// VlanQuota stores aggregate network quota of the environment, empty or zero quota removes it.
+func (i *Instance) VlanQuota(vlan, quota string) error {
+	if i.client != nil {
+		return i.call("VlanQuota", nil, vlan, quota)
+	}
+	return i.db.Update(func(tx *bolt.Tx) error {
+		if quota == "" || quota == "0" {
+			return tx.Bucket(vlanquota).Delete([]byte(vlan))
+		}
+		return tx.Bucket(vlanquota).Put([]byte(vlan), []byte(quota))
+	})
+}
+
+// VlanQuotaGet returns aggregate network quota of the environment.
+func (i *Instance) VlanQuotaGet(vlan string) (quota string) {
+	if i.client != nil {
+		i.call("VlanQuotaGet", &quota, vlan)
+		return quota
+	}
+	i.db.View(func(tx *bolt.Tx) error {
+		quota = string(tx.Bucket(vlanquota).Get([]byte(vlan)))
+		return nil
+	})
+	return quota
+}
+
 func (i *Instance) ContainerByName(name string) map[string]string {
+	if i.client != nil {
+		var r map[string]string
+		i.call("ContainerByName", &r, name)
+		return r
+	}
 	c := make(map[string]string)
 	i.db.View(func(tx *bolt.Tx) error {
 		if b := tx.Bucket(containers); b != nil {
@@ -221,7 +387,16 @@ func (i *Instance) ContainerByName(name string) map[string]string {
 }
 
 func (i *Instance) ContainerByKey(key, value string) (list []string) {
+	if i.client != nil {
+		var r []string
+		i.call("ContainerByKey", &r, key, value)
+		return r
+	}
 	i.db.View(func(tx *bolt.Tx) error {
+		if idx := tx.Bucket(containerindex).Bucket([]byte(key)); idx != nil {
+			list = prefixKeys(idx, value+"\x00")
+			return nil
+		}
 		if b := tx.Bucket(containers); b != nil {
 			b.ForEach(func(k, v []byte) error {
 				if c := b.Bucket(k); c != nil {
@@ -241,6 +416,9 @@ func (i *Instance) ContainerByKey(key, value string) (list []string) {
 }
 
 func (i *Instance) PortMapSet(protocol, internal, external string, ops map[string]string) (err error) {
+	if i.client != nil {
+		return i.call("PortMapSet", nil, protocol, internal, external, ops)
+	}
 	i.db.Update(func(tx *bolt.Tx) error {
 		if b := tx.Bucket(portmap); b != nil {
 			b, err = b.CreateBucketIfNotExists([]byte(protocol))
@@ -248,6 +426,9 @@ func (i *Instance) PortMapSet(protocol, internal, external string, ops map[strin
 				b, err = b.CreateBucketIfNotExists([]byte(external))
 				if err == nil {
 					b, err = b.CreateBucketIfNotExists([]byte(internal))
+					if err == nil {
+						err = indexPort(tx, protocol, internal, external)
+					}
 					for k, v := range ops {
 						b.Put([]byte(k), []byte(v))
 					}
@@ -261,6 +442,9 @@ func (i *Instance) PortMapSet(protocol, internal, external string, ops map[strin
 }
 
 func (i *Instance) SetMapMethod(protocol, external, policy string) (err error) {
+	if i.client != nil {
+		return i.call("SetMapMethod", nil, protocol, external, policy)
+	}
 	i.db.Update(func(tx *bolt.Tx) error {
 		if b := tx.Bucket(portmap); b != nil {
 			if b = b.Bucket([]byte(protocol)); b != nil {
@@ -275,6 +459,11 @@ func (i *Instance) SetMapMethod(protocol, external, policy string) (err error) {
 }
 
 func (i *Instance) GetMapMethod(protocol, external string) (policy string) {
+	if i.client != nil {
+		var r string
+		i.call("GetMapMethod", &r, protocol, external)
+		return r
+	}
 	i.db.Update(func(tx *bolt.Tx) error {
 		if b := tx.Bucket(portmap); b != nil {
 			if b = b.Bucket([]byte(protocol)); b != nil {
@@ -289,17 +478,19 @@ func (i *Instance) GetMapMethod(protocol, external string) (policy string) {
 }
 
 func (i *Instance) ExtPorts(protocol, internal string) (list []string) {
+	if i.client != nil {
+		var r []string
+		i.call("ExtPorts", &r, protocol, internal)
+		return r
+	}
 	i.db.View(func(tx *bolt.Tx) error {
-		if b := tx.Bucket(portmap); b != nil {
-			if b = b.Bucket([]byte(protocol)); b != nil {
-				b.ForEach(func(k, v []byte) error {
-					if c := b.Bucket(k); c != nil {
-						if kk, _ := c.Cursor().Seek([]byte(internal + ":")); kk != nil {
-							list = append(list, string(k))
-						}
-					}
-					return nil
-				})
+		if idx := tx.Bucket(portindex).Bucket([]byte(protocol)); idx != nil {
+			seen := make(map[string]bool)
+			for _, k := range prefixKeys(idx, internal+":") {
+				if external := k[strings.Index(k, "\x00")+1:]; !seen[external] {
+					seen[external] = true
+					list = append(list, external)
+				}
 			}
 		}
 		return nil
@@ -307,6 +498,11 @@ func (i *Instance) ExtPorts(protocol, internal string) (list []string) {
 	return
 }
 func (i *Instance) PortMapDelete(protocol, internal, external string) (left int) {
+	if i.client != nil {
+		var r int
+		i.call("PortMapDelete", &r, protocol, internal, external)
+		return r
+	}
 	i.db.Update(func(tx *bolt.Tx) error {
 		if b := tx.Bucket(portmap); b != nil {
 			if b := b.Bucket([]byte(protocol)); b != nil {
@@ -314,17 +510,26 @@ func (i *Instance) PortMapDelete(protocol, internal, external string) (left int)
 					if b = b.Bucket([]byte(external)); b != nil {
 						left = b.Stats().BucketN - 1
 						if !strings.Contains(internal, ":") {
-							c := b.Cursor()
-							for k, _ := c.Seek([]byte(internal + ":")); k != nil && bytes.HasPrefix(k, []byte(internal+":")); k, _ = c.Next() {
-								b.DeleteBucket(k)
+							for _, port := range prefixKeys(b, internal+":") {
+								b.DeleteBucket([]byte(internal + ":" + port))
+								unindexPort(tx, protocol, internal+":"+port, external)
 								left--
 							}
 						} else if b.Bucket([]byte(internal)) != nil {
 							b.DeleteBucket([]byte(internal))
+							unindexPort(tx, protocol, internal, external)
 							left--
 						}
 					}
 				} else if len(external) > 0 {
+					if e := b.Bucket([]byte(external)); e != nil {
+						e.ForEach(func(k, v []byte) error {
+							if v != nil {
+								return nil
+							}
+							return unindexPort(tx, protocol, string(k), external)
+						})
+					}
 					b.DeleteBucket([]byte(external))
 				}
 			}
@@ -335,6 +540,11 @@ func (i *Instance) PortMapDelete(protocol, internal, external string) (left int)
 }
 
 func (i *Instance) PortInMap(protocol, external, internal string) (res bool) {
+	if i.client != nil {
+		var r bool
+		i.call("PortInMap", &r, protocol, external, internal)
+		return r
+	}
 	i.db.View(func(tx *bolt.Tx) error {
 		if b := tx.Bucket(portmap); b != nil {
 			if b = b.Bucket([]byte(protocol)); b != nil {
@@ -343,12 +553,7 @@ func (i *Instance) PortInMap(protocol, external, internal string) (res bool) {
 						res = true
 						return nil
 					} else if !strings.Contains(internal, ":") {
-						b.ForEach(func(k, v []byte) error {
-							if strings.Contains(string(k), internal+":") {
-								res = true
-							}
-							return nil
-						})
+						res = len(prefixKeys(b, internal+":")) > 0
 					} else if b.Bucket([]byte(internal)) != nil {
 						res = true
 						return nil
@@ -360,3 +565,103 @@ func (i *Instance) PortInMap(protocol, external, internal string) (res bool) {
 	})
 	return
 }
+
+// Mapping is a port mapping with its backends.
+type Mapping struct {
+	Protocol string
+	External string
+	Domain   string
+	Policy   string
+	Nodes    []string
+}
+
+// PortMapping returns the port mapping of the external port. Nodes are empty if the port is not mapped.
+func (i *Instance) PortMapping(protocol, external string) (m Mapping) {
+	if i.client != nil {
+		var r Mapping
+		i.call("PortMapping", &r, protocol, external)
+		return r
+	}
+	m.Protocol, m.External = protocol, external
+	i.db.View(func(tx *bolt.Tx) error {
+		if b := tx.Bucket(portmap).Bucket([]byte(protocol)); b != nil {
+			if b = b.Bucket([]byte(external)); b != nil {
+				m.Policy = string(b.Get([]byte("policy")))
+				b.ForEach(func(k, v []byte) error {
+					if c := b.Bucket(k); c != nil {
+						m.Nodes = append(m.Nodes, string(k))
+						if d := c.Get([]byte("domain")); d != nil && len(m.Domain) == 0 {
+							m.Domain = string(d)
+						}
+					}
+					return nil
+				})
+			}
+		}
+		return nil
+	})
+	return m
+}
+
+// PortMappings returns all port mappings.
+func (i *Instance) PortMappings() (list []Mapping) {
+	if i.client != nil {
+		var r []Mapping
+		i.call("PortMappings", &r)
+		return r
+	}
+	var ports [][2]string
+	i.db.View(func(tx *bolt.Tx) error {
+		return tx.Bucket(portmap).ForEach(func(protocol, v []byte) error {
+			if b := tx.Bucket(portmap).Bucket(protocol); b != nil {
+				b.ForEach(func(external, v []byte) error {
+					ports = append(ports, [2]string{string(protocol), string(external)})
+					return nil
+				})
+			}
+			return nil
+		})
+	})
+	for _, p := range ports {
+		list = append(list, i.PortMapping(p[0], p[1]))
+	}
+	return list
+}
+
+// PoolSet stores the number of standby clones kept for the template, zero size removes the pool.
+func (i *Instance) PoolSet(template string, size int) error {
+	if i.client != nil {
+		return i.call("PoolSet", nil, template, size)
+	}
+	return i.db.Update(func(tx *bolt.Tx) error {
+		if b := tx.Bucket(pools); b != nil {
+			if size <= 0 {
+				return b.Delete([]byte(template))
+			}
+			return b.Put([]byte(template), []byte(strconv.Itoa(size)))
+		}
+		return nil
+	})
+}
+
+// PoolList returns templates with configured warm pools and their sizes.
+func (i *Instance) PoolList() map[string]int {
+	if i.client != nil {
+		var r map[string]int
+		i.call("PoolList", &r)
+		return r
+	}
+	list := make(map[string]int)
+	i.db.View(func(tx *bolt.Tx) error {
+		if b := tx.Bucket(pools); b != nil {
+			b.ForEach(func(k, v []byte) error {
+				if size, err := strconv.Atoi(string(v)); err == nil {
+					list[string(k)] = size
+				}
+				return nil
+			})
+		}
+		return nil
+	})
+	return list
+}
@@ -0,0 +1,148 @@
+package db
+
+import (
+	"bytes"
+	"strconv"
+
+	"github.com/boltdb/bolt"
+)
+
+var (
+	containerindex = []byte("containerindex")
+	portindex      = []byte("portindex")
+	uidfree        = []byte("uidfree")
+	uidnames       = []byte("uidnames")
+	// uidnext keeps the start of the next never used UID range under nextKey
+	uidnext = []byte("uidnext")
+	nextKey = []byte("next")
+)
+
+// indexedKeys are container options with secondary index kept in containerindex bucket.
+var indexedKeys = []string{"ip", "vlan"}
+
+// indexKey joins indexed value and the name of the item it points to, so all items with the value are found by prefix.
+func indexKey(value, name string) []byte {
+	return []byte(value + "\x00" + name)
+}
+
+// prefixKeys returns the rest of the keys of the bucket starting with the prefix.
+func prefixKeys(b *bolt.Bucket, prefix string) (list []string) {
+	c := b.Cursor()
+	for k, _ := c.Seek([]byte(prefix)); k != nil && bytes.HasPrefix(k, []byte(prefix)); k, _ = c.Next() {
+		list = append(list, string(k[len(prefix):]))
+	}
+	return list
+}
+
+// indexContainer updates index entries of the container for the options about to be stored.
+func indexContainer(tx *bolt.Tx, name string, options map[string]string) error {
+	for _, key := range indexedKeys {
+		value, ok := options[key]
+		if !ok {
+			continue
+		}
+		idx, err := tx.Bucket(containerindex).CreateBucketIfNotExists([]byte(key))
+		if err != nil {
+			return err
+		}
+		if c := tx.Bucket(containers).Bucket([]byte(name)); c != nil {
+			if old := c.Get([]byte(key)); old != nil {
+				if err = idx.Delete(indexKey(string(old), name)); err != nil {
+					return err
+				}
+			}
+		}
+		if err = idx.Put(indexKey(value, name), nil); err != nil {
+			return err
+		}
+	}
+	return nil
+}
+
+// unindexContainer removes index entries of the container.
+func unindexContainer(tx *bolt.Tx, name string) error {
+	c := tx.Bucket(containers).Bucket([]byte(name))
+	if c == nil {
+		return nil
+	}
+	for _, key := range indexedKeys {
+		if idx := tx.Bucket(containerindex).Bucket([]byte(key)); idx != nil {
+			if value := c.Get([]byte(key)); value != nil {
+				if err := idx.Delete(indexKey(string(value), name)); err != nil {
+					return err
+				}
+			}
+		}
+	}
+	return nil
+}
+
+// indexPort adds internal socket to external port entry.
+func indexPort(tx *bolt.Tx, protocol, internal, external string) error {
+	idx, err := tx.Bucket(portindex).CreateBucketIfNotExists([]byte(protocol))
+	if err != nil {
+		return err
+	}
+	return idx.Put(indexKey(internal, external), nil)
+}
+
+// unindexPort removes internal socket to external port entry.
+func unindexPort(tx *bolt.Tx, protocol, internal, external string) error {
+	if idx := tx.Bucket(portindex).Bucket([]byte(protocol)); idx != nil {
+		return idx.Delete(indexKey(internal, external))
+	}
+	return nil
+}
+
+// rebuildIndex fills index buckets from the data, it is used for databases created before indexes were introduced.
+func rebuildIndex(tx *bolt.Tx) error {
+	err := tx.Bucket(containers).ForEach(func(k, v []byte) error {
+		if c := tx.Bucket(containers).Bucket(k); c != nil {
+			options := make(map[string]string)
+			for _, key := range indexedKeys {
+				if value := c.Get([]byte(key)); value != nil {
+					options[key] = string(value)
+				}
+			}
+			return indexContainer(tx, string(k), options)
+		}
+		return nil
+	})
+	if err != nil {
+		return err
+	}
+
+	err = tx.Bucket(portmap).ForEach(func(protocol, v []byte) error {
+		p := tx.Bucket(portmap).Bucket(protocol)
+		if p == nil {
+			return nil
+		}
+		return p.ForEach(func(external, v []byte) error {
+			e := p.Bucket(external)
+			if e == nil {
+				return nil
+			}
+			return e.ForEach(func(internal, v []byte) error {
+				if v != nil {
+					return nil
+				}
+				return indexPort(tx, string(protocol), string(internal), string(external))
+			})
+		})
+	})
+	if err != nil {
+		return err
+	}
+
+	return tx.Bucket(uuidmap).ForEach(func(uid, name []byte) error {
+		if string(name) == "#" {
+			return tx.Bucket(uidfree).Put(uid, nil)
+		}
+		return tx.Bucket(uidnames).Put(indexKey(string(name), string(uid)), nil)
+	})
+}
+
+// seedUID sets the next UID range after the ranges of the UID map, it walks the map once.
+func seedUID(tx *bolt.Tx) error {
+	return tx.Bucket(uidnext).Put(nextKey, []byte(strconv.Itoa(65536+65536*tx.Bucket(uuidmap).Stats().KeyN)))
+}
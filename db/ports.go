@@ -0,0 +1,146 @@
+package db
+
+import (
+	"encoding/binary"
+	"errors"
+	"strconv"
+
+	"github.com/boltdb/bolt"
+)
+
+var portbitmap = []byte("portbitmap")
+
+const (
+	minPort = 1000
+	maxPort = 65535
+)
+
+// reservedPorts are system ports which are never given to port mappings.
+var reservedPorts = map[int]bool{8443: true, 8444: true, 8086: true}
+
+// portFamily returns the socket protocol the port map protocol listens on; http and https are served over tcp.
+func portFamily(protocol string) []byte {
+	if protocol == "udp" {
+		return []byte("udp")
+	}
+	return []byte("tcp")
+}
+
+// bitmap is a set of used ports, one bit per port.
+type bitmap []byte
+
+func (b bitmap) get(port int) bool {
+	return b[port/8]&(1<<uint(port%8)) != 0
+}
+
+func (b bitmap) set(port int, used bool) {
+	if used {
+		b[port/8] |= 1 << uint(port%8)
+	} else {
+		b[port/8] &^= 1 << uint(port%8)
+	}
+}
+
+// portBucket returns the bucket of the protocol family with the copy of its bitmap.
+func portBucket(tx *bolt.Tx, protocol string) (*bolt.Bucket, bitmap, error) {
+	b, err := tx.Bucket(portbitmap).CreateBucketIfNotExists(portFamily(protocol))
+	if err != nil {
+		return nil, nil, err
+	}
+	bm := make(bitmap, (maxPort+1)/8)
+	copy(bm, b.Get([]byte("bitmap")))
+	return b, bm, nil
+}
+
+// AllocPort picks free external port for the protocol and marks it used.
+// Ports listed in busy are taken by other sockets of the host and skipped.
+// Search continues from the last allocated port, so released ports are not reused immediately.
+func (i *Instance) AllocPort(protocol string, busy map[int]bool) (port int, err error) {
+	if i.client != nil {
+		err = i.call("AllocPort", &port, protocol, busy)
+		return
+	}
+	err = i.db.Update(func(tx *bolt.Tx) error {
+		b, bm, err := portBucket(tx, protocol)
+		if err != nil {
+			return err
+		}
+		next := minPort
+		if v := b.Get([]byte("next")); len(v) == 4 {
+			next = int(binary.BigEndian.Uint32(v))
+		}
+		for n := 0; n <= maxPort-minPort; n++ {
+			p := minPort + (next-minPort+n)%(maxPort-minPort+1)
+			// skip fully used bytes at once
+			if p%8 == 0 && bm[p/8] == 0xFF {
+				n += 7
+				continue
+			}
+			if bm.get(p) || busy[p] || reservedPorts[p] {
+				continue
+			}
+			bm.set(p, true)
+			port = p
+			v := make([]byte, 4)
+			binary.BigEndian.PutUint32(v, uint32(p+1))
+			if err = b.Put([]byte("next"), v); err != nil {
+				return err
+			}
+			return b.Put([]byte("bitmap"), bm)
+		}
+		return errors.New("No free ports left for " + protocol)
+	})
+	return
+}
+
+// ReservePort marks the ports used by the protocol, it's used for the ports requested explicitly.
+func (i *Instance) ReservePort(protocol string, ports []int) error {
+	if i.client != nil {
+		return i.call("ReservePort", nil, protocol, ports)
+	}
+	return i.db.Update(func(tx *bolt.Tx) error {
+		return markPorts(tx, protocol, ports, true)
+	})
+}
+
+// ReleasePort returns the port of the protocol to the allocator.
+func (i *Instance) ReleasePort(protocol string, port int) error {
+	if i.client != nil {
+		return i.call("ReleasePort", nil, protocol, port)
+	}
+	return i.db.Update(func(tx *bolt.Tx) error {
+		return markPorts(tx, protocol, []int{port}, false)
+	})
+}
+
+func markPorts(tx *bolt.Tx, protocol string, ports []int, used bool) error {
+	b, bm, err := portBucket(tx, protocol)
+	if err != nil {
+		return err
+	}
+	for _, p := range ports {
+		if p < minPort || p > maxPort {
+			return errors.New("Port " + strconv.Itoa(p) + " is out of range")
+		}
+		bm.set(p, used)
+	}
+	return b.Put([]byte("bitmap"), bm)
+}
+
+// seedPorts marks external ports of existing port mappings as used.
+func seedPorts(tx *bolt.Tx) error {
+	return tx.Bucket(portmap).ForEach(func(protocol, v []byte) error {
+		p := tx.Bucket(portmap).Bucket(protocol)
+		if p == nil {
+			return nil
+		}
+		var ports []int
+		p.ForEach(func(external, v []byte) error {
+			if port, err := strconv.Atoi(string(external)); err == nil && port >= minPort && port <= maxPort {
+				ports = append(ports, port)
+			}
+			return nil
+		})
+		return markPorts(tx, string(protocol), ports, true)
+	})
+}
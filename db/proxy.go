@@ -0,0 +1,158 @@
+package db
+
+import (
+	"strconv"
+	"strings"
+
+	"github.com/boltdb/bolt"
+)
+
+var proxies = []byte("proxy")
+
+// Proxy is a domain of the environment served by the reverse proxy.
+type Proxy struct {
+	Vlan   string
+	Domain string
+	Policy string
+	// Cert is the path of certificate and key files without extension, empty for plain http.
+	Cert  string
+	Nodes []string
+}
+
+// ProxySet stores the domain of the environment replacing the previous entry.
+func (i *Instance) ProxySet(p Proxy) error {
+	if i.client != nil {
+		return i.call("ProxySet", nil, p)
+	}
+	return i.db.Update(func(tx *bolt.Tx) error {
+		b := tx.Bucket(proxies)
+		if b.Bucket([]byte(p.Vlan)) != nil {
+			if err := b.DeleteBucket([]byte(p.Vlan)); err != nil {
+				return err
+			}
+		}
+		v, err := b.CreateBucket([]byte(p.Vlan))
+		if err != nil {
+			return err
+		}
+		for k, val := range map[string]string{"domain": p.Domain, "policy": p.Policy, "cert": p.Cert} {
+			if err = v.Put([]byte(k), []byte(val)); err != nil {
+				return err
+			}
+		}
+		n, err := v.CreateBucket([]byte("nodes"))
+		if err != nil {
+			return err
+		}
+		for _, node := range p.Nodes {
+			if err = n.Put([]byte(node), nil); err != nil {
+				return err
+			}
+		}
+		return nil
+	})
+}
+
+// ProxyGet returns the domain of the environment. Domain is empty if it's not configured.
+func (i *Instance) ProxyGet(vlan string) (p Proxy) {
+	if i.client != nil {
+		var r Proxy
+		i.call("ProxyGet", &r, vlan)
+		return r
+	}
+	p.Vlan = vlan
+	i.db.View(func(tx *bolt.Tx) error {
+		if v := tx.Bucket(proxies).Bucket([]byte(vlan)); v != nil {
+			p.Domain = string(v.Get([]byte("domain")))
+			p.Policy = string(v.Get([]byte("policy")))
+			p.Cert = string(v.Get([]byte("cert")))
+			if n := v.Bucket([]byte("nodes")); n != nil {
+				n.ForEach(func(k, val []byte) error {
+					p.Nodes = append(p.Nodes, string(k))
+					return nil
+				})
+			}
+		}
+		return nil
+	})
+	return p
+}
+
+// ProxyDel removes the domain of the environment.
+func (i *Instance) ProxyDel(vlan string) error {
+	if i.client != nil {
+		return i.call("ProxyDel", nil, vlan)
+	}
+	return i.db.Update(func(tx *bolt.Tx) error {
+		if tx.Bucket(proxies).Bucket([]byte(vlan)) != nil {
+			return tx.Bucket(proxies).DeleteBucket([]byte(vlan))
+		}
+		return nil
+	})
+}
+
+// Proxies returns domains of all environments.
+func (i *Instance) Proxies() (list []Proxy) {
+	if i.client != nil {
+		var r []Proxy
+		i.call("Proxies", &r)
+		return r
+	}
+	var vlans []string
+	i.db.View(func(tx *bolt.Tx) error {
+		return tx.Bucket(proxies).ForEach(func(k, v []byte) error {
+			vlans = append(vlans, string(k))
+			return nil
+		})
+	})
+	for _, vlan := range vlans {
+		list = append(list, i.ProxyGet(vlan))
+	}
+	return list
+}
+
+var backends = []byte("backends")
+
+// Backend is the health state of proxy or port mapping node.
+type Backend struct {
+	Down   bool
+	Weight int
+}
+
+// BackendSet stores the state of the node, zero state removes the entry.
+func (i *Instance) BackendSet(node string, b Backend) error {
+	if i.client != nil {
+		return i.call("BackendSet", nil, node, b)
+	}
+	return i.db.Update(func(tx *bolt.Tx) error {
+		if b == (Backend{}) {
+			return tx.Bucket(backends).Delete([]byte(node))
+		}
+		value := strconv.Itoa(b.Weight)
+		if b.Down {
+			value += " down"
+		}
+		return tx.Bucket(backends).Put([]byte(node), []byte(value))
+	})
+}
+
+// Backends returns states of the nodes.
+func (i *Instance) Backends() map[string]Backend {
+	if i.client != nil {
+		var r map[string]Backend
+		i.call("Backends", &r)
+		return r
+	}
+	list := make(map[string]Backend)
+	i.db.View(func(tx *bolt.Tx) error {
+		return tx.Bucket(backends).ForEach(func(k, v []byte) error {
+			state := strings.Fields(string(v))
+			if len(state) > 0 {
+				weight, _ := strconv.Atoi(state[0])
+				list[string(k)] = Backend{Weight: weight, Down: len(state) > 1 && state[1] == "down"}
+			}
+			return nil
+		})
+	})
+	return list
+}
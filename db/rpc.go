@@ -0,0 +1,154 @@
+package db
+
+import (
+	"encoding/gob"
+	"errors"
+	"net"
+	"net/rpc"
+	"os"
+	"reflect"
+
+	"github.com/boltdb/bolt"
+
+	"github.com/subutai-io/agent/config"
+	"github.com/subutai-io/agent/log"
+)
+
+// shared is the database handle opened by the daemon for its whole lifetime.
+var shared *bolt.DB
+
+var errorType = reflect.TypeOf((*error)(nil)).Elem()
+
+func init() {
+	// types passed inside of interface values should be known to gob
+	gob.Register(map[string]string{})
+	gob.Register([]map[string]string{})
+	gob.Register(map[string]int{})
+	gob.Register(map[int]bool{})
+	gob.Register([]int{})
+	gob.Register(Mapping{})
+	gob.Register(Proxy{})
+	gob.Register([]Mapping{})
+	gob.Register([]Proxy{})
+	gob.Register(Backend{})
+	gob.Register(map[string]Backend{})
+}
+
+// Request is a database call forwarded to the daemon.
+type Request struct {
+	Method string
+	Args   []interface{}
+}
+
+// Reply holds the results of the database call, error result is passed as a text.
+type Reply struct {
+	Values []interface{}
+	Err    string
+}
+
+// Service exposes methods of the shared database instance to the commands.
+type Service struct {
+	i *Instance
+}
+
+// Call runs the requested method of the database instance.
+func (s *Service) Call(req Request, reply *Reply) error {
+	m := reflect.ValueOf(s.i).MethodByName(req.Method)
+	if !m.IsValid() || req.Method == "Close" {
+		return errors.New("Unknown database method " + req.Method)
+	}
+	if m.Type().NumIn() != len(req.Args) {
+		return errors.New("Wrong number of arguments for " + req.Method)
+	}
+
+	args := make([]reflect.Value, len(req.Args))
+	for n, arg := range req.Args {
+		if arg == nil {
+			args[n] = reflect.Zero(m.Type().In(n))
+		} else {
+			args[n] = reflect.ValueOf(arg)
+		}
+		if !args[n].Type().AssignableTo(m.Type().In(n)) {
+			return errors.New("Wrong argument type for " + req.Method)
+		}
+	}
+
+	for _, v := range m.Call(args) {
+		if v.Type() == errorType {
+			if !v.IsNil() {
+				reply.Err = v.Interface().(error).Error()
+			}
+			continue
+		}
+		reply.Values = append(reply.Values, v.Interface())
+	}
+	return nil
+}
+
+// call forwards the method to the daemon storing its first result into result pointer, if any.
+// If the daemon can't be reached, the instance opens the database file and runs the method itself,
+// so methods returning only values don't silently return zero values.
+// Returned error is either the error result of the method or the failure to reach the database.
+func (i *Instance) call(method string, result interface{}, args ...interface{}) error {
+	var reply Reply
+	req := Request{Method: method, Args: args}
+	if err := i.client.Call("Service.Call", req, &reply); err != nil {
+		log.Check(log.WarnLevel, "Calling database method "+method, err)
+		local, oerr := open()
+		if log.Check(log.WarnLevel, "Opening database", oerr) {
+			return err
+		}
+		i.client.Close()
+		i.client, i.db = nil, local.db
+		reply = Reply{}
+		if err = (&Service{i: i}).Call(req, &reply); err != nil {
+			return err
+		}
+	}
+	if result != nil && len(reply.Values) > 0 && reply.Values[0] != nil {
+		reflect.ValueOf(result).Elem().Set(reflect.ValueOf(reply.Values[0]))
+	}
+	if len(reply.Err) != 0 {
+		return errors.New(reply.Err)
+	}
+	return nil
+}
+
+func socket() string {
+	return config.Agent.DataPrefix + "agent.sock"
+}
+
+// Dial connects to the daemon socket to call the database or other services registered by Serve.
+func Dial() (*rpc.Client, error) {
+	return rpc.Dial("unix", socket())
+}
+
+// Serve opens the database for the daemon lifetime and starts listening for the calls of the commands on the local socket.
+// Database file stays locked by the daemon, so commands don't wait for each other to open it.
+// Other daemon services can be exposed to the commands on the same socket by passing them as receivers.
+func Serve(rcvrs ...interface{}) error {
+	i, err := open()
+	if err != nil {
+		return err
+	}
+	shared = i.db
+
+	server := rpc.NewServer()
+	if err = server.Register(&Service{i: &Instance{db: shared, shared: true}}); err != nil {
+		return err
+	}
+	for _, rcvr := range rcvrs {
+		if err = server.Register(rcvr); err != nil {
+			return err
+		}
+	}
+
+	os.Remove(socket())
+	l, err := net.Listen("unix", socket())
+	if err != nil {
+		return err
+	}
+	log.Check(log.WarnLevel, "Setting socket permissions", os.Chmod(socket(), 0600))
+	go server.Accept(l)
+	return nil
+}
@@ -0,0 +1,139 @@
+package container
+
+import (
+	"os"
+	"sync"
+	"time"
+
+	"github.com/subutai-io/agent/config"
+
+	"gopkg.in/lxc/go-lxc.v2"
+)
+
+// handle is a go-lxc container object shared between callers of the package.
+// The object keeps parsed configuration of the container, so it is dropped
+// once configuration file changes on disk or container is destroyed or renamed.
+type handle struct {
+	c     *lxc.Container
+	name  string
+	refs  int
+	stale bool
+	mtime time.Time
+}
+
+var (
+	handleLock sync.Mutex
+	handles    = make(map[string]*handle)
+	inuse      = make(map[*lxc.Container]*handle)
+)
+
+// Acquire returns cached go-lxc object of the container, creating it on first use.
+// Each successful call must be paired with Release.
+func Acquire(name string) (*lxc.Container, error) {
+	handleLock.Lock()
+	defer handleLock.Unlock()
+
+	var mtime time.Time
+	if f, err := os.Stat(config.Agent.LxcPrefix + name + "/config"); err == nil {
+		mtime = f.ModTime()
+	}
+	if h, ok := handles[name]; ok {
+		if h.mtime.Equal(mtime) {
+			h.refs++
+			return h.c, nil
+		}
+		drop(h)
+	}
+
+	c, err := lxc.NewContainer(name, config.Agent.LxcPrefix)
+	if err != nil {
+		return nil, err
+	}
+	h := &handle{c: c, name: name, refs: 1, mtime: mtime}
+	handles[name] = h
+	inuse[c] = h
+	return c, nil
+}
+
+// Release returns container object obtained by Acquire back to the cache.
+func Release(c *lxc.Container) {
+	handleLock.Lock()
+	defer handleLock.Unlock()
+
+	if h, ok := inuse[c]; ok {
+		if h.refs--; h.refs <= 0 && h.stale {
+			delete(inuse, c)
+			lxc.Release(c)
+		}
+	}
+}
+
+// Invalidate removes cached object of the container. It should be called when container
+// is destroyed, renamed or its configuration is changed.
+func Invalidate(name string) {
+	handleLock.Lock()
+	defer handleLock.Unlock()
+
+	if h, ok := handles[name]; ok {
+		drop(h)
+	}
+}
+
+// drop detaches handle from the cache and frees it if nobody holds it.
+// Caller must hold handleLock.
+func drop(h *handle) {
+	delete(handles, h.name)
+	h.stale = true
+	if h.refs <= 0 {
+		delete(inuse, h.c)
+		lxc.Release(h.c)
+	}
+}
+
+// prune drops cached objects of containers which no longer exist, e.g. destroyed or renamed by a command
+// while the daemon held their objects.
+func prune() {
+	handleLock.Lock()
+	defer handleLock.Unlock()
+
+	for name, h := range handles {
+		if _, err := os.Stat(config.Agent.LxcPrefix + name + "/config"); os.IsNotExist(err) {
+			drop(h)
+		}
+	}
+}
+
+// States returns human readable state for each container in the list. States come from the monitor table
+// if it's running, otherwise liblxc is asked once for all active containers and only those are queried
+// one by one, the rest are stopped.
+func States(names []string) map[string]string {
+	prune()
+	list := make(map[string]string, len(names))
+	stateLock.RLock()
+	if stateTable != nil {
+		for _, name := range names {
+			if state, ok := stateTable[name]; ok {
+				list[name] = state
+			}
+		}
+	}
+	stateLock.RUnlock()
+
+	if len(list) == len(names) {
+		return list
+	}
+	active := make(map[string]bool)
+	for _, name := range lxc.ActiveContainerNames(config.Agent.LxcPrefix) {
+		active[name] = true
+	}
+	for _, name := range names {
+		if _, ok := list[name]; ok {
+			continue
+		} else if active[name] {
+			list[name] = query(name)
+		} else {
+			list[name] = "STOPPED"
+		}
+	}
+	return list
+}
@@ -7,11 +7,12 @@ import (
 	"errors"
 	"io/ioutil"
 	"os"
-	"os/exec"
 	"runtime"
 	"strconv"
 	"strings"
+	"sync"
 	"syscall"
+	"time"
 
 	"github.com/subutai-io/agent/config"
 	"github.com/subutai-io/agent/db"
@@ -42,10 +43,10 @@ func Templates() (containers []string) {
 	return
 }
 
-// Containers returns list of all containers
+// Containers returns list of all containers except standby clones of the warm pools
 func Containers() (containers []string) {
 	for _, name := range All() {
-		if !IsTemplate(name) {
+		if !IsStandby(name) && !IsTemplate(name) {
 			containers = append(containers, name)
 		}
 	}
@@ -64,10 +65,20 @@ func IsContainer(name string) bool {
 
 // State returns container stat in human readable format.
 func State(name string) (state string) {
-	c, err := lxc.NewContainer(name, config.Agent.LxcPrefix)
+	if state, ok := monitored(name); ok {
+		return state
+	}
+	return query(name)
+}
+
+// query asks liblxc for the current state of the container.
+func query(name string) (state string) {
+	c, err := Acquire(name)
 	if err != nil {
 		return "UNKNOWN"
 	}
+	defer Release(c)
+
 	switch c.State() {
 	case lxc.STOPPED:
 		return "STOPPED"
@@ -118,10 +129,6 @@ func SetApt(name string) {
 
 // Start starts the Subutai container.
 func Start(name string) {
-	c, err := lxc.NewContainer(name, config.Agent.LxcPrefix)
-	log.Check(log.FatalLevel, "Looking for container "+name, err)
-	log.Check(log.DebugLevel, "Starting LXC container", c.Start())
-
 	if _, err := os.Stat(config.Agent.LxcPrefix + name + "/.stop"); err == nil {
 		log.Check(log.WarnLevel, "Deleting .stop file to "+name, os.Remove(config.Agent.LxcPrefix+name+"/.stop"))
 	}
@@ -130,14 +137,38 @@ func Start(name string) {
 		log.Check(log.WarnLevel, "Creating .start file to "+name, err)
 		log.Check(log.WarnLevel, "Closing .start file "+name, f.Close())
 	}
+	c, err := Acquire(name)
+	log.Check(log.FatalLevel, "Looking for container "+name, err)
+	log.Check(log.DebugLevel, "Starting LXC container", c.Start())
+	Release(c)
+	restoreNet(name)
+}
+
+// restoreNet applies stored network quotas of the container and its environment,
+// shaping is lost when the container interface is removed on stop.
+func restoreNet(name string) {
+	bolt, err := db.New()
+	if log.Check(log.WarnLevel, "Opening database", err) {
+		return
+	}
+	rate := bolt.ContainerQuotas(name)["network"]
+	vlan := bolt.ContainerByName(name)["vlan"]
+	var aggregate string
+	if len(vlan) != 0 {
+		aggregate = bolt.VlanQuotaGet(vlan)
+	}
+	log.Check(log.WarnLevel, "Closing database", bolt.Close())
+
+	if len(rate) != 0 && rate != "0" {
+		net.RateLimit(GetConfigItem(config.Agent.LxcPrefix+name+"/config", "lxc.network.veth.pair"), rate)
+	}
+	if len(aggregate) != 0 {
+		net.RateLimit("gw-"+vlan, aggregate)
+	}
 }
 
 // Stop stops the Subutai container.
 func Stop(name string) {
-	c, err := lxc.NewContainer(name, config.Agent.LxcPrefix)
-	log.Check(log.FatalLevel, "Looking for container "+name, err)
-	log.Check(log.DebugLevel, "Stopping LXC container", c.Stop())
-
 	if _, err := os.Stat(config.Agent.LxcPrefix + name + "/.start"); err == nil {
 		log.Check(log.WarnLevel, "Creating .start file to "+name, os.Remove(config.Agent.LxcPrefix+name+"/.start"))
 	}
@@ -146,6 +177,10 @@ func Stop(name string) {
 		log.Check(log.WarnLevel, "Creating .stop file to "+name, err)
 		log.Check(log.WarnLevel, "Closing .stop file "+name, f.Close())
 	}
+	c, err := Acquire(name)
+	log.Check(log.FatalLevel, "Looking for container "+name, err)
+	log.Check(log.DebugLevel, "Stopping LXC container", c.Stop())
+	Release(c)
 }
 
 // AttachExec executes a command inside Subutai container.
@@ -154,8 +189,12 @@ func AttachExec(name string, command []string, env ...[]string) (output []string
 		return output, errors.New("Container does not exists")
 	}
 
-	container, err := lxc.NewContainer(name, config.Agent.LxcPrefix)
-	if container.State() != lxc.RUNNING || err != nil {
+	container, err := Acquire(name)
+	if err != nil {
+		return output, err
+	}
+	defer Release(container)
+	if container.State() != lxc.RUNNING {
 		return output, errors.New("Container is " + container.State().String())
 	}
 
@@ -198,10 +237,14 @@ func AttachExec(name string, command []string, env ...[]string) (output []string
 
 // Destroy deletes the Subutai container.
 func Destroy(name string) {
-	c, err := lxc.NewContainer(name, config.Agent.LxcPrefix)
-	if !log.Check(log.WarnLevel, "Creating container object", err) && c.State() == lxc.RUNNING {
-		log.Check(log.FatalLevel, "Stopping container", c.Stop())
+	c, err := Acquire(name)
+	if !log.Check(log.WarnLevel, "Creating container object", err) {
+		if c.State() == lxc.RUNNING {
+			log.Check(log.FatalLevel, "Stopping container", c.Stop())
+		}
+		Release(c)
 	}
+	Invalidate(name)
 	fs.SubvolumeDestroy(config.Agent.LxcPrefix + name)
 
 	db, err := db.New()
@@ -221,22 +264,34 @@ func GetParent(name string) string {
 }
 
 // Clone create the duplicate container from the Subutai template.
-func Clone(parent, child string) {
+// LXC clone and snapshots of the container volumes are made concurrently, then
+// clone related options are written to the container config together with extra conf lines.
+func Clone(parent, child string, conf ...[]string) {
 	var backend lxc.BackendStore
 	log.Check(log.DebugLevel, "Setting LXC backend to BTRFS", backend.Set("btrfs"))
 
-	c, err := lxc.NewContainer(parent, config.Agent.LxcPrefix)
+	c, err := Acquire(parent)
 	log.Check(log.FatalLevel, "Looking for container "+parent, err)
+	defer Release(c)
 
 	fs.SubvolumeCreate(config.Agent.LxcPrefix + child)
-	err = c.Clone(child, lxc.CloneOptions{Backend: backend})
-	log.Check(log.FatalLevel, "Cloning container", err)
 
-	fs.SubvolumeClone(config.Agent.LxcPrefix+parent+"/home", config.Agent.LxcPrefix+child+"/home")
-	fs.SubvolumeClone(config.Agent.LxcPrefix+parent+"/opt", config.Agent.LxcPrefix+child+"/opt")
-	fs.SubvolumeClone(config.Agent.LxcPrefix+parent+"/var", config.Agent.LxcPrefix+child+"/var")
-
-	SetContainerConf(child, [][]string{
+	var wg sync.WaitGroup
+	for _, vol := range []string{"home", "opt", "var"} {
+		wg.Add(1)
+		go func(vol string) {
+			defer wg.Done()
+			start := time.Now()
+			fs.SubvolumeClone(config.Agent.LxcPrefix+parent+"/"+vol, config.Agent.LxcPrefix+child+"/"+vol)
+			log.Debug("Snapshot of " + vol + " for " + child + " took " + time.Since(start).String())
+		}(vol)
+	}
+	start := time.Now()
+	log.Check(log.FatalLevel, "Cloning container", c.Clone(child, lxc.CloneOptions{Backend: backend}))
+	log.Debug("LXC clone of " + child + " took " + time.Since(start).String())
+	wg.Wait()
+
+	SetContainerConf(child, append([][]string{
 		{"lxc.network.link", ""},
 		{"lxc.network.veth.pair", strings.Replace(GetConfigItem(config.Agent.LxcPrefix+child+"/config", "lxc.network.hwaddr"), ":", "", -1)},
 		{"lxc.network.script.up", config.Agent.AppPrefix + "bin/create_ovs_interface"},
@@ -245,7 +300,7 @@ func Clone(parent, child string) {
 		{"lxc.mount.entry", config.Agent.LxcPrefix + child + "/opt opt none bind,rw 0 0"},
 		{"lxc.mount.entry", config.Agent.LxcPrefix + child + "/var var none bind,rw 0 0"},
 		{"lxc.network.mtu", "1300"},
-	})
+	}, conf...))
 }
 
 // ResetNet sets default parameters of the network configuration for container.
@@ -267,8 +322,9 @@ func ResetNet(name string) {
 // QuotaRAM sets the memory quota to the Subutai container.
 // If quota size argument is missing, it's just return current value.
 func QuotaRAM(name string, size ...string) int {
-	c, err := lxc.NewContainer(name, config.Agent.LxcPrefix)
+	c, err := Acquire(name)
 	log.Check(log.DebugLevel, "Looking for container: "+name, err)
+	defer Release(c)
 	i, err := strconv.Atoi(size[0])
 	log.Check(log.DebugLevel, "Parsing quota size", err)
 	if i > 0 {
@@ -284,8 +340,9 @@ func QuotaRAM(name string, size ...string) int {
 // If passed value < 100, we assume that this value mean percents.
 // If passed value > 100, we assume that this value mean MHz.
 func QuotaCPU(name string, size ...string) int {
-	c, cErr := lxc.NewContainer(name, config.Agent.LxcPrefix)
+	c, cErr := Acquire(name)
 	log.Check(log.DebugLevel, "Looking for container: "+name, cErr)
+	defer Release(c)
 	cfsPeriod := 100000
 	tmp, cErr := strconv.Atoi(size[0])
 	log.Check(log.DebugLevel, "Parsing quota size", cErr)
@@ -324,8 +381,9 @@ func QuotaCPU(name string, size ...string) int {
 
 // QuotaCPUset sets particular cores that can be used by the Subutai container.
 func QuotaCPUset(name string, size ...string) string {
-	c, err := lxc.NewContainer(name, config.Agent.LxcPrefix)
+	c, err := Acquire(name)
 	log.Check(log.DebugLevel, "Looking for container: "+name, err)
+	defer Release(c)
 	if size[0] != "" {
 		log.Check(log.DebugLevel, "Setting cpuset.cpus", c.SetCgroupItem("cpuset.cpus", size[0]))
 		SetContainerConf(name, [][]string{{"lxc.cgroup.cpuset.cpus", size[0]}})
@@ -333,11 +391,9 @@ func QuotaCPUset(name string, size ...string) string {
 	return c.CgroupItem("cpuset.cpus")[0]
 }
 
-// QuotaNet sets network bandwidth for the Subutai container.
+// QuotaNet sets network bandwidth for the Subutai container, in Kbps for each direction.
 func QuotaNet(name string, size ...string) string {
-	c, err := lxc.NewContainer(name, config.Agent.LxcPrefix)
-	log.Check(log.DebugLevel, "Looking for container: "+name, err)
-	nic := GetConfigItem(c.ConfigFileName(), "lxc.network.veth.pair")
+	nic := GetConfigItem(config.Agent.LxcPrefix+name+"/config", "lxc.network.veth.pair")
 	if size[0] != "" {
 		SetContainerConf(name, [][]string{{"subutai.network.ratelimit", size[0]}})
 	}
@@ -376,6 +432,7 @@ func SetContainerConf(container string, conf [][]string) {
 	}
 
 	log.Check(log.FatalLevel, "Writing container config "+confPath, ioutil.WriteFile(confPath, []byte(newconf), 0644))
+	Invalidate(container)
 }
 
 // GetConfigItem return any parameter from the configuration file of the Subutai container.
@@ -396,33 +453,60 @@ func GetConfigItem(path, item string) string {
 // SetContainerUID sets UID map shifting for the Subutai container.
 // It's required option for any unprivileged LXC container.
 func SetContainerUID(c string) {
+	uid := AllocUID(c)
+	SetContainerConf(c, UIDConf(uid))
+	ShiftUID(c, uid)
+}
+
+// AllocUID reserves the first UID of the container UID map.
+func AllocUID(c string) string {
 	uid := "65536"
 	if bolt, err := db.New(); err == nil {
 		uid = bolt.GetUuidEntry(c)
 		log.Check(log.WarnLevel, "Closing database", bolt.Close())
 	}
+	if len(uid) == 0 {
+		log.Fatal("Allocating UID map for " + c)
+	}
+	return uid
+}
 
-	SetContainerConf(c, [][]string{
+// UIDConf returns container configuration lines for UID map starting from uid.
+func UIDConf(uid string) [][]string {
+	return [][]string{
 		{"lxc.include", config.Agent.AppPrefix + "share/lxc/config/ubuntu.common.conf"},
 		{"lxc.include", config.Agent.AppPrefix + "share/lxc/config/ubuntu.userns.conf"},
 		{"lxc.id_map", "u 0 " + uid + " 65536"},
 		{"lxc.id_map", "g 0 " + uid + " 65536"},
-	})
-
-	if s, err := os.Stat(config.Agent.LxcPrefix + c + "/rootfs"); err == nil {
-		parentuid := strconv.Itoa(int(s.Sys().(*syscall.Stat_t).Uid))
+	}
+}
 
-		err = exec.Command("uidmapshift", "-b", config.Agent.LxcPrefix+c+"/rootfs/", parentuid, uid, "65536").Run()
-		log.Check(log.DebugLevel, "uidmapshift rootfs", err)
-		err = exec.Command("uidmapshift", "-b", config.Agent.LxcPrefix+c+"/home/", parentuid, uid, "65536").Run()
-		log.Check(log.DebugLevel, "uidmapshift home", err)
-		err = exec.Command("uidmapshift", "-b", config.Agent.LxcPrefix+c+"/opt/", parentuid, uid, "65536").Run()
-		log.Check(log.DebugLevel, "uidmapshift opt", err)
-		err = exec.Command("uidmapshift", "-b", config.Agent.LxcPrefix+c+"/var/", parentuid, uid, "65536").Run()
-		log.Check(log.DebugLevel, "uidmapshift var", err)
+// ShiftUID shifts ownership of the container volumes from parent UID map to uid.
+// Volumes are processed concurrently.
+func ShiftUID(c, uid string) {
+	s, err := os.Stat(config.Agent.LxcPrefix + c + "/rootfs")
+	if err != nil {
+		return
+	}
+	parentuid := int(s.Sys().(*syscall.Stat_t).Uid)
+	newuid, err := strconv.Atoi(uid)
+	if log.Check(log.WarnLevel, "Parsing container UID", err) {
+		return
+	}
 
-		log.Check(log.ErrorLevel, "Setting chmod 755 on lxc home", os.Chmod(config.Agent.LxcPrefix+c, 0755))
+	var wg sync.WaitGroup
+	for _, vol := range []string{"rootfs", "home", "opt", "var"} {
+		wg.Add(1)
+		go func(vol string) {
+			defer wg.Done()
+			start := time.Now()
+			log.Check(log.WarnLevel, "Shifting UID of "+vol, fs.ShiftOwner(config.Agent.LxcPrefix+c+"/"+vol, parentuid, newuid, 65536))
+			log.Debug("UID shift of " + c + " " + vol + " took " + time.Since(start).String())
+		}(vol)
 	}
+	wg.Wait()
+
+	log.Check(log.ErrorLevel, "Setting chmod 755 on lxc home", os.Chmod(config.Agent.LxcPrefix+c, 0755))
 }
 
 // SetDNS configures the Subutai containers to use internal DNS-server from the Resource Host.
@@ -443,6 +527,7 @@ func SetDNS(name string) {
 
 // SetEnvID is deprecated function and should be removed.
 func SetEnvID(name, envID string) {
+	rootfs := config.Agent.LxcPrefix + name + "/rootfs"
 	err := os.MkdirAll(config.Agent.LxcPrefix+name+"/rootfs/etc/subutai", 755)
 	log.Check(log.FatalLevel, "Creating etc/subutai directory", err)
 
@@ -453,6 +538,13 @@ func SetEnvID(name, envID string) {
 	_, err = config.WriteString("[Subutai-Agent]\n" + envID + "\n")
 	log.Check(log.FatalLevel, "Writing environment id to config", err)
 	log.Check(log.DebugLevel, "Synced /etc/subutai/lxc-config", config.Sync())
+
+	// rootfs may be already shifted to the container UID map, so new files should follow its owner
+	if s, err := os.Stat(rootfs); err == nil {
+		uid, gid := int(s.Sys().(*syscall.Stat_t).Uid), int(s.Sys().(*syscall.Stat_t).Gid)
+		log.Check(log.DebugLevel, "Setting owner of etc/subutai", os.Chown(rootfs+"/etc/subutai", uid, gid))
+		log.Check(log.DebugLevel, "Setting owner of lxc-config", config.Chown(uid, gid))
+	}
 }
 
 // SetStaticNet sets static IP-address for the Subutai container.
@@ -0,0 +1,70 @@
+package container
+
+import (
+	"bufio"
+	"os/exec"
+	"regexp"
+	"sync"
+	"time"
+
+	"github.com/subutai-io/agent/config"
+	"github.com/subutai-io/agent/log"
+)
+
+var (
+	stateLock  sync.RWMutex
+	stateTable map[string]string
+	transition = regexp.MustCompile(`'(.+)' changed state to \[(\w+)\]`)
+)
+
+// Monitor subscribes to LXC state transitions using lxc-monitor and keeps the state table
+// consulted by State, so monitored processes do not need to query liblxc on every call.
+// The notify callback is invoked on every transition. Monitor never returns.
+func Monitor(notify func(name, state string)) {
+	for {
+		cmd := exec.Command("lxc-monitor", "-P", config.Agent.LxcPrefix, "-n", ".*")
+		out, err := cmd.StdoutPipe()
+		if !log.Check(log.WarnLevel, "Opening lxc-monitor output", err) &&
+			!log.Check(log.WarnLevel, "Starting lxc-monitor", cmd.Start()) {
+			// the table is seeded only after subscription, so no transition can be lost in between
+			seed()
+			scanner := bufio.NewScanner(out)
+			for scanner.Scan() {
+				if m := transition.FindStringSubmatch(scanner.Text()); len(m) == 3 {
+					stateLock.Lock()
+					stateTable[m[1]] = m[2]
+					stateLock.Unlock()
+					if m[2] == "STOPPED" {
+						// stopped containers may be destroyed or renamed by commands, the daemon doesn't see that
+						Invalidate(m[1])
+					}
+					notify(m[1], m[2])
+				}
+			}
+			log.Check(log.WarnLevel, "lxc-monitor exited", cmd.Wait())
+		}
+		stateLock.Lock()
+		stateTable = nil
+		stateLock.Unlock()
+		time.Sleep(5 * time.Second)
+	}
+}
+
+// seed fills the state table with current state of every container.
+func seed() {
+	table := make(map[string]string)
+	for _, name := range All() {
+		table[name] = query(name)
+	}
+	stateLock.Lock()
+	stateTable = table
+	stateLock.Unlock()
+}
+
+// monitored returns container state from the table if Monitor is running.
+func monitored(name string) (string, bool) {
+	stateLock.RLock()
+	defer stateLock.RUnlock()
+	state, ok := stateTable[name]
+	return state, ok
+}
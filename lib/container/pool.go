@@ -0,0 +1,102 @@
+package container
+
+import (
+	"crypto/rand"
+	"encoding/hex"
+	"io/ioutil"
+	"os"
+	"strings"
+
+	"github.com/subutai-io/agent/config"
+	"github.com/subutai-io/agent/db"
+	"github.com/subutai-io/agent/log"
+)
+
+const (
+	// standbyPrefix is reserved for prepared clones kept in warm pools of the templates.
+	standbyPrefix = "standby-"
+	// preparePrefix is reserved for clones being prepared, they are not listed by Standby until they are ready.
+	preparePrefix = "preparing-"
+)
+
+// IsStandby checks if container is a prepared clone waiting in the warm pool or a clone being prepared for it.
+func IsStandby(name string) bool {
+	return strings.HasPrefix(name, standbyPrefix) || strings.HasPrefix(name, preparePrefix)
+}
+
+// Standby returns list of prepared clones of the template.
+func Standby(template string) (list []string) {
+	for _, name := range All() {
+		if strings.HasPrefix(name, standbyPrefix) && GetParent(name) == template {
+			list = append(list, name)
+		}
+	}
+	return list
+}
+
+// Prepare creates stopped clone of the template with shifted UID map and default settings
+// and puts it into the warm pool. It returns the name of the clone.
+// The clone is prepared under a temporary name and gets into the pool only when it's ready,
+// clones left by interrupted preparation are removed by Purge.
+func Prepare(template string) string {
+	suffix := make([]byte, 4)
+	_, err := rand.Read(suffix)
+	log.Check(log.FatalLevel, "Generating standby clone name", err)
+	tmp := preparePrefix + template + "-" + hex.EncodeToString(suffix)
+	name := standbyPrefix + template + "-" + hex.EncodeToString(suffix)
+
+	Clone(template, tmp)
+	uid := AllocUID(tmp)
+	SetContainerConf(tmp, UIDConf(uid))
+	ShiftUID(tmp, uid)
+	SetApt(tmp)
+	SetDNS(tmp)
+	DisableSSHPwd(tmp)
+	if err = Rename(tmp, name); err != nil {
+		Destroy(tmp)
+		log.Fatal("Moving " + tmp + " to the pool, " + err.Error())
+	}
+	return name
+}
+
+// Purge destroys clones left half-prepared by interrupted Prepare, freeing their UID map entries.
+// It should be called when no Prepare is running.
+func Purge() {
+	list, err := ioutil.ReadDir(config.Agent.LxcPrefix)
+	if err != nil {
+		return
+	}
+	for _, f := range list {
+		if strings.HasPrefix(f.Name(), preparePrefix) {
+			log.Debug("Removing half-prepared clone " + f.Name())
+			Destroy(f.Name())
+		}
+	}
+}
+
+// Rename moves stopped container to the new name updating its configuration and UID map entry.
+// The directory rename is atomic, so only one caller can take particular standby clone.
+func Rename(src, dst string) error {
+	Invalidate(src)
+	if err := os.Rename(config.Agent.LxcPrefix+src, config.Agent.LxcPrefix+dst); err != nil {
+		return err
+	}
+
+	SetContainerConf(dst, [][]string{
+		{"lxc.utsname", dst},
+		{"subutai.git.branch", dst},
+		{"lxc.mount", config.Agent.LxcPrefix + dst + "/fstab"},
+		{"lxc.rootfs", config.Agent.LxcPrefix + dst + "/rootfs"},
+		{"lxc.rootfs.mount", config.Agent.LxcPrefix + dst + "/rootfs"},
+		{"lxc.mount.entry", config.Agent.LxcPrefix + dst + "/home home none bind,rw 0 0"},
+		{"lxc.mount.entry", config.Agent.LxcPrefix + dst + "/opt opt none bind,rw 0 0"},
+		{"lxc.mount.entry", config.Agent.LxcPrefix + dst + "/var var none bind,rw 0 0"},
+	})
+
+	bolt, err := db.New()
+	if !log.Check(log.WarnLevel, "Opening database", err) {
+		log.Check(log.WarnLevel, "Renaming uuid entry", bolt.RenameUuidEntry(src, dst))
+		log.Check(log.WarnLevel, "Closing database", bolt.Close())
+	}
+	return nil
+}
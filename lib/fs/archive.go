@@ -0,0 +1,227 @@
+package fs
+
+import (
+	"archive/tar"
+	"bufio"
+	"bytes"
+	"crypto/md5"
+	"fmt"
+	"hash"
+	"io"
+	"io/ioutil"
+	"os"
+	"path"
+	"path/filepath"
+	"runtime"
+	"strconv"
+	"sync"
+	"syscall"
+
+	"github.com/klauspost/compress/zstd"
+	"github.com/klauspost/pgzip"
+
+	"github.com/subutai-io/agent/config"
+)
+
+var (
+	zstdMagic = []byte{0x28, 0xb5, 0x2f, 0xfd}
+	niced     sync.Once
+)
+
+// Archive is a tarball compressed by blocks in parallel, with gzip or zstd depending on compression option of [template] section.
+// Gzip archives are readable by any gzip decompressor, zstd archives are recognized by Decompress.
+type Archive struct {
+	file *os.File
+	sum  hash.Hash
+	zw   io.WriteCloser
+	tw   *tar.Writer
+}
+
+// NewArchive creates the archive file. Compression uses the number of cores set by cores option of [template] section,
+// all of them if it's not set, and runs with the lowest CPU priority to leave the host responsive.
+// Compressed data is hashed with MD5 as it's written, see Sum.
+func NewArchive(file string) (*Archive, error) {
+	niced.Do(lowPriority)
+	f, err := os.Create(file)
+	if err != nil {
+		return nil, err
+	}
+	a := &Archive{file: f, sum: md5.New()}
+	w := io.MultiWriter(f, a.sum)
+	if config.Template.Compression == "zstd" {
+		a.zw, err = zstd.NewWriter(w, zstd.WithEncoderConcurrency(cores()))
+	} else {
+		var zw *pgzip.Writer
+		if zw, err = pgzip.NewWriterLevel(w, pgzip.DefaultCompression); err == nil {
+			err = zw.SetConcurrency(1<<20, cores())
+		}
+		a.zw = zw
+	}
+	if err != nil {
+		f.Close()
+		os.Remove(file)
+		return nil, err
+	}
+	a.tw = tar.NewWriter(a.zw)
+	return a, nil
+}
+
+// Add writes the file or directory to the archive with the name.
+func (a *Archive) Add(file, name string) error {
+	info, err := os.Lstat(file)
+	if err != nil {
+		return err
+	}
+	link := ""
+	if info.Mode()&os.ModeSymlink != 0 {
+		if link, err = os.Readlink(file); err != nil {
+			return err
+		}
+	}
+	hdr, err := tar.FileInfoHeader(info, link)
+	if err != nil {
+		return err
+	}
+	hdr.Name = filepath.ToSlash(name)
+	if info.IsDir() {
+		hdr.Name += "/"
+	}
+	if err = a.tw.WriteHeader(hdr); err != nil || !info.Mode().IsRegular() {
+		return err
+	}
+	f, err := os.Open(file)
+	if err != nil {
+		return err
+	}
+	defer f.Close()
+	_, err = io.Copy(a.tw, f)
+	return err
+}
+
+// AddAll writes the content of the folder to the archive, names are relative to the folder.
+func (a *Archive) AddAll(folder string) error {
+	return filepath.Walk(folder, func(file string, info os.FileInfo, err error) error {
+		if err != nil {
+			return err
+		}
+		name, err := filepath.Rel(folder, file)
+		if err != nil || name == "." {
+			return err
+		}
+		return a.Add(file, name)
+	})
+}
+
+// Close finishes the archive and closes the file.
+func (a *Archive) Close() error {
+	err := a.tw.Close()
+	if zerr := a.zw.Close(); err == nil {
+		err = zerr
+	}
+	if ferr := a.file.Close(); err == nil {
+		err = ferr
+	}
+	return err
+}
+
+// Sum returns MD5 hash sum of the archive file, it's complete after Close.
+func (a *Archive) Sum() string {
+	return fmt.Sprintf("%x", a.sum.Sum(nil))
+}
+
+// Decompress returns decompressed stream of gzip or zstd archive, the format is detected by magic bytes.
+// Blocks are decompressed ahead of the reader in parallel, so the reader should be closed to release them.
+func Decompress(r io.Reader) (io.ReadCloser, error) {
+	br := bufio.NewReader(r)
+	if magic, _ := br.Peek(len(zstdMagic)); bytes.Equal(magic, zstdMagic) {
+		zr, err := zstd.NewReader(br, zstd.WithDecoderConcurrency(cores()))
+		if err != nil {
+			return nil, err
+		}
+		return zr.IOReadCloser(), nil
+	}
+	return pgzip.NewReaderN(br, 1<<20, cores())
+}
+
+// Compression returns the compression of the archive file by its magic bytes, "zstd" or "gzip".
+// Archives keep .tar.gz name in both cases, as templates are looked up by it.
+func Compression(file string) (string, error) {
+	f, err := os.Open(file)
+	if err != nil {
+		return "", err
+	}
+	defer f.Close()
+	magic := make([]byte, len(zstdMagic))
+	if _, err = io.ReadFull(f, magic); err == nil && bytes.Equal(magic, zstdMagic) {
+		return "zstd", nil
+	}
+	return "gzip", nil
+}
+
+// Untar extracts gzip or zstd compressed archive into the directory.
+func Untar(archive, dir string) error {
+	f, err := os.Open(archive)
+	if err != nil {
+		return err
+	}
+	defer f.Close()
+	zr, err := Decompress(f)
+	if err != nil {
+		return err
+	}
+	defer zr.Close()
+
+	tr := tar.NewReader(zr)
+	for {
+		hdr, err := tr.Next()
+		if err == io.EOF {
+			return nil
+		} else if err != nil {
+			return err
+		}
+		dst := filepath.Join(dir, path.Clean("/"+hdr.Name))
+		mode := os.FileMode(hdr.Mode).Perm()
+		if err = os.MkdirAll(filepath.Dir(dst), 0755); err != nil {
+			return err
+		}
+		switch hdr.Typeflag {
+		case tar.TypeDir:
+			err = os.MkdirAll(dst, mode)
+		case tar.TypeSymlink:
+			os.Remove(dst)
+			err = os.Symlink(hdr.Linkname, dst)
+		case tar.TypeReg:
+			var out *os.File
+			if out, err = os.OpenFile(dst, os.O_WRONLY|os.O_CREATE|os.O_TRUNC, mode); err == nil {
+				_, err = io.Copy(out, tr)
+				if cerr := out.Close(); err == nil {
+					err = cerr
+				}
+			}
+		}
+		if err != nil {
+			return err
+		}
+	}
+}
+
+// cores returns the number of cores used for compression.
+func cores() int {
+	if config.Template.Cores > 0 && config.Template.Cores < runtime.NumCPU() {
+		return config.Template.Cores
+	}
+	return runtime.NumCPU()
+}
+
+// lowPriority sets the lowest CPU priority to all threads of the process, threads started later inherit it.
+func lowPriority() {
+	tasks, err := ioutil.ReadDir("/proc/self/task")
+	if err != nil {
+		return
+	}
+	for _, task := range tasks {
+		if tid, err := strconv.Atoi(task.Name()); err == nil {
+			syscall.Setpriority(syscall.PRIO_PROCESS, tid, 19)
+		}
+	}
+}
@@ -0,0 +1,45 @@
+package fs
+
+import (
+	"crypto/md5"
+	"fmt"
+	"io/ioutil"
+	"os"
+	"path/filepath"
+	"testing"
+)
+
+func TestArchive(t *testing.T) {
+	dir, err := ioutil.TempDir("", "archive")
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer os.RemoveAll(dir)
+
+	ioutil.WriteFile(filepath.Join(dir, "config"), []byte("subutai.parent = master\n"), 0644)
+	a, err := NewArchive(filepath.Join(dir, "template.tar.gz"))
+	if err != nil {
+		t.Fatal(err)
+	}
+	if err = a.Add(filepath.Join(dir, "config"), "config"); err != nil {
+		t.Fatal(err)
+	}
+	if err = a.Close(); err != nil {
+		t.Fatal(err)
+	}
+
+	data, err := ioutil.ReadFile(filepath.Join(dir, "template.tar.gz"))
+	if err != nil {
+		t.Fatal(err)
+	}
+	if sum := fmt.Sprintf("%x", md5.Sum(data)); a.Sum() != sum {
+		t.Errorf("Sum() = %s, want %s", a.Sum(), sum)
+	}
+
+	if err = Untar(filepath.Join(dir, "template.tar.gz"), filepath.Join(dir, "out")); err != nil {
+		t.Fatal(err)
+	}
+	if data, err = ioutil.ReadFile(filepath.Join(dir, "out", "config")); err != nil || string(data) != "subutai.parent = master\n" {
+		t.Errorf("extracted config = %q, %v", data, err)
+	}
+}
@@ -4,6 +4,8 @@ package fs
 import (
 	"bufio"
 	"bytes"
+	"errors"
+	"io"
 	"io/ioutil"
 	"os"
 	"os/exec"
@@ -94,22 +96,31 @@ func id(path string) string {
 // Receive creates BTRFS subvolume using saved delta-file, it can depend on some parent.
 // Parent subvolume should be installed before receiving child subvolume.
 func Receive(src, dst, delta string, parent bool) {
+	input, err := os.Open(config.Agent.LxcPrefix + "tmpdir/" + delta)
+	if !log.Check(log.FatalLevel, "Opening delta "+delta, err) {
+		defer input.Close()
+		log.Check(log.FatalLevel, "Receiving delta "+delta, ReceiveStream(src, dst, input, parent))
+	}
+}
+
+// ReceiveStream works as Receive reading the delta from the stream, so deltas of downloaded templates are not stored on disk.
+func ReceiveStream(src, dst string, delta io.Reader, parent bool) error {
 	args := []string{"receive", "-p", src, dst}
 	if !parent {
 		args = []string{"receive", dst}
 	}
 	log.Debug(strings.Join(args, " "))
 	receive := exec.Command("btrfs", args...)
-	input, err := os.Open(config.Agent.LxcPrefix + "tmpdir/" + delta)
-	if !log.Check(log.FatalLevel, "Opening delta "+delta, err) {
-		defer input.Close()
-		receive.Stdin = input
-		out, err := receive.CombinedOutput()
-		log.Check(log.FatalLevel, "Receiving delta "+delta+": "+string(out), err)
+	receive.Stdin = delta
+	if out, err := receive.CombinedOutput(); err != nil {
+		return errors.New(err.Error() + ": " + string(out))
 	}
+	return nil
 }
 
 // Send creates delta-file using BTRFS subvolume, it can depend on some parent.
+// Errors are returned instead of exiting, so the caller running several sends can wait for the others,
+// the read-only snapshot of the subvolume is removed in any case.
 func Send(src, dst, delta string) error {
 	tmpDir, err := ioutil.TempDir(config.Agent.LxcPrefix+"tmpdir/", "export")
 	if err != nil {
@@ -120,16 +131,18 @@ func Send(src, dst, delta string) error {
 	if path := strings.Split(dst, "/"); len(path) > 0 {
 		tmpVolume := tmpDir + "/" + path[len(path)-1]
 
-		SubvolumeClone(dst, tmpVolume)
+		if out, err := exec.Command("btrfs", "subvolume", "snapshot", "-r", dst, tmpVolume).CombinedOutput(); err != nil {
+			return errors.New("Creating snapshot: " + err.Error() + ": " + string(out))
+		}
 		defer SubvolumeDestroy(tmpVolume)
-		SetVolReadOnly(tmpVolume, true)
 
+		args := []string{"send", tmpVolume, "-f", delta}
 		if src != dst {
-			err = exec.Command("btrfs", "send", "-p", src, tmpVolume, "-f", delta).Run()
-		} else {
-			err = exec.Command("btrfs", "send", tmpVolume, "-f", delta).Run()
+			args = []string{"send", "-p", src, tmpVolume, "-f", delta}
+		}
+		if out, err := exec.Command("btrfs", args...).CombinedOutput(); err != nil {
+			return errors.New(err.Error() + ": " + string(out))
 		}
-		return err
 	}
 	return nil
 }
@@ -4,8 +4,6 @@ import (
 	"io"
 	"os"
 
-	"github.com/jhoonb/archivex"
-
 	"github.com/subutai-io/agent/log"
 )
 
@@ -25,8 +23,8 @@ func Copy(source string, dest string) {
 
 // Tar function creates archive file of specified folder
 func Tar(folder, file string) {
-	archive := new(archivex.TarFile)
-	archive.Create(file)
-	log.Check(log.FatalLevel, "Packing file "+folder, archive.AddAll(folder, false))
-	archive.Close()
+	archive, err := NewArchive(file)
+	log.Check(log.FatalLevel, "Creating archive "+file, err)
+	log.Check(log.FatalLevel, "Packing file "+folder, archive.AddAll(folder))
+	log.Check(log.FatalLevel, "Closing archive "+file, archive.Close())
 }
@@ -0,0 +1,204 @@
+package fs
+
+import (
+	"encoding/binary"
+	"errors"
+	"os"
+	"runtime"
+	"sync"
+	"syscall"
+)
+
+const (
+	capXattr        = "security.capability"
+	capRevisionMask = 0xFF000000
+	capRevision3    = 0x03000000
+	aclVersion      = 2
+	aclUser         = 0x02
+	aclGroup        = 0x08
+
+	atFdcwd           = -0x64
+	atSymlinkNofollow = 0x100
+)
+
+var aclXattrs = []string{"system.posix_acl_access", "system.posix_acl_default"}
+
+// errOverlap is returned for overlapping ranges, an id in both of them could be either shifted or not.
+var errOverlap = errors.New("Source and target id ranges overlap")
+
+// shifter remaps owners of the inodes from one id range to another.
+type shifter struct {
+	from, to, size uint32
+	sem            chan struct{}
+	wg             sync.WaitGroup
+	mu             sync.Mutex
+	err            error
+}
+
+// ShiftOwner remaps UID and GID of every inode under the path from the range [from, from+size) to the range starting at to.
+// Directories are walked in parallel and symlinks are changed themselves, never followed.
+// Inodes already owned by the target range are skipped, so interrupted shifting can be safely repeated.
+// Named entries of POSIX ACLs and file capabilities are remapped as well, capabilities and setuid bits dropped by chown are restored.
+// Ranges must not overlap, as the skipping couldn't tell shifted ids from not shifted ones.
+func ShiftOwner(path string, from, to, size int) error {
+	if from == to {
+		return nil
+	} else if from < to+size && to < from+size {
+		return errOverlap
+	}
+	s := &shifter{
+		from: uint32(from),
+		to:   uint32(to),
+		size: uint32(size),
+		sem:  make(chan struct{}, runtime.NumCPU()*2),
+	}
+
+	var st syscall.Stat_t
+	if err := syscall.Lstat(path, &st); err != nil {
+		return err
+	}
+	s.shift(path, &st)
+	if st.Mode&syscall.S_IFMT == syscall.S_IFDIR {
+		s.walk(path)
+	}
+	s.wg.Wait()
+	return s.err
+}
+
+// walk shifts directory entries and descends into subdirectories,
+// handing them to new goroutines while there are free workers.
+func (s *shifter) walk(dir string) {
+	for _, sub := range s.dir(dir) {
+		select {
+		case s.sem <- struct{}{}:
+			s.wg.Add(1)
+			go func(sub string) {
+				defer s.wg.Done()
+				s.walk(sub)
+				<-s.sem
+			}(sub)
+		default:
+			s.walk(sub)
+		}
+	}
+}
+
+// dir shifts all entries of the directory and returns list of subdirectories.
+func (s *shifter) dir(dir string) (subdirs []string) {
+	f, err := os.Open(dir)
+	if err != nil {
+		s.fail(err)
+		return nil
+	}
+	names, err := f.Readdirnames(-1)
+	f.Close()
+	if err != nil {
+		s.fail(err)
+	}
+
+	for _, name := range names {
+		path := dir + "/" + name
+		var st syscall.Stat_t
+		if err := syscall.Lstat(path, &st); err != nil {
+			s.fail(err)
+			continue
+		}
+		s.shift(path, &st)
+		if st.Mode&syscall.S_IFMT == syscall.S_IFDIR {
+			subdirs = append(subdirs, path)
+		}
+	}
+	return subdirs
+}
+
+// shift changes the owner of a single inode keeping its capabilities, setuid/setgid bits and ACLs.
+func (s *shifter) shift(path string, st *syscall.Stat_t) {
+	uid, gid := s.remap(st.Uid), s.remap(st.Gid)
+	if uid == st.Uid && gid == st.Gid {
+		return
+	}
+
+	link := st.Mode&syscall.S_IFMT == syscall.S_IFLNK
+	var caps []byte
+	if !link {
+		caps = getxattr(path, capXattr)
+	}
+
+	if err := syscall.Fchownat(atFdcwd, path, int(uid), int(gid), atSymlinkNofollow); err != nil {
+		s.fail(&os.PathError{Op: "fchownat", Path: path, Err: err})
+		return
+	}
+	if link {
+		return
+	}
+
+	if st.Mode&(syscall.S_ISUID|syscall.S_ISGID) != 0 {
+		s.fail(syscall.Chmod(path, st.Mode&07777))
+	}
+	s.remapCaps(caps)
+	if caps != nil {
+		s.fail(syscall.Setxattr(path, capXattr, caps, 0))
+	}
+	for _, name := range aclXattrs {
+		if acl := getxattr(path, name); s.remapACL(acl) {
+			s.fail(syscall.Setxattr(path, name, acl, 0))
+		}
+	}
+}
+
+// remap returns new id for the inode owner, ids outside of source range or already in the target range are kept.
+func (s *shifter) remap(id uint32) uint32 {
+	if id-s.to < s.size || id-s.from >= s.size {
+		return id
+	}
+	return id - s.from + s.to
+}
+
+// remapCaps shifts root id of namespaced (revision 3) file capabilities xattr in place.
+func (s *shifter) remapCaps(caps []byte) {
+	if len(caps) >= 24 && binary.LittleEndian.Uint32(caps)&capRevisionMask == capRevision3 {
+		binary.LittleEndian.PutUint32(caps[20:], s.remap(binary.LittleEndian.Uint32(caps[20:])))
+	}
+}
+
+// remapACL shifts ids of named user and group entries of the POSIX ACL xattr in place.
+// It returns true if ACL was changed.
+func (s *shifter) remapACL(acl []byte) (changed bool) {
+	if len(acl) < 4 || binary.LittleEndian.Uint32(acl) != aclVersion {
+		return false
+	}
+	for e := acl[4:]; len(e) >= 8; e = e[8:] {
+		if tag := binary.LittleEndian.Uint16(e); tag == aclUser || tag == aclGroup {
+			if id := binary.LittleEndian.Uint32(e[4:]); s.remap(id) != id {
+				binary.LittleEndian.PutUint32(e[4:], s.remap(id))
+				changed = true
+			}
+		}
+	}
+	return changed
+}
+
+// fail keeps the first error occurred during shifting.
+func (s *shifter) fail(err error) {
+	if err == nil {
+		return
+	}
+	s.mu.Lock()
+	if s.err == nil {
+		s.err = err
+	}
+	s.mu.Unlock()
+}
+
+// getxattr returns value of extended attribute or nil if it is not set.
+func getxattr(path, name string) []byte {
+	size, err := syscall.Getxattr(path, name, nil)
+	if err != nil || size <= 0 {
+		return nil
+	}
+	value := make([]byte, size)
+	if size, err = syscall.Getxattr(path, name, value); err != nil {
+		return nil
+	}
+	return value[:size]
+}
@@ -0,0 +1,200 @@
+package fs
+
+import (
+	"encoding/binary"
+	"io/ioutil"
+	"os"
+	"os/exec"
+	"path/filepath"
+	"strconv"
+	"sync"
+	"syscall"
+	"testing"
+)
+
+const (
+	benchFiles = 500000
+	benchDirs  = 500
+)
+
+var (
+	benchOnce sync.Once
+	benchDir  string
+)
+
+func TestMain(m *testing.M) {
+	code := m.Run()
+	if len(benchDir) != 0 {
+		os.RemoveAll(benchDir)
+	}
+	os.Exit(code)
+}
+
+func TestRemap(t *testing.T) {
+	s := &shifter{from: 100000, to: 165536, size: 65536}
+	for id, want := range map[uint32]uint32{
+		0:      0,
+		99999:  99999,
+		100000: 165536,
+		100001: 165537,
+		165535: 231071,
+		231071: 231071,
+		231072: 231072,
+	} {
+		if got := s.remap(id); got != want {
+			t.Errorf("remap(%d) = %d, want %d", id, got, want)
+		}
+	}
+}
+
+func TestRemapCaps(t *testing.T) {
+	s := &shifter{from: 100000, to: 165536, size: 65536}
+
+	caps := make([]byte, 24)
+	binary.LittleEndian.PutUint32(caps, capRevision3|1)
+	binary.LittleEndian.PutUint32(caps[20:], 100000)
+	s.remapCaps(caps)
+	if got := binary.LittleEndian.Uint32(caps[20:]); got != 165536 {
+		t.Errorf("rootid of v3 capabilities = %d, want 165536", got)
+	}
+
+	caps = make([]byte, 20)
+	binary.LittleEndian.PutUint32(caps, 0x02000000|1)
+	binary.LittleEndian.PutUint32(caps[4:], 100000)
+	s.remapCaps(caps)
+	if got := binary.LittleEndian.Uint32(caps[4:]); got != 100000 {
+		t.Errorf("v2 capabilities changed to %d", got)
+	}
+}
+
+func TestRemapACL(t *testing.T) {
+	s := &shifter{from: 100000, to: 165536, size: 65536}
+	acl := make([]byte, 4+8*3)
+	binary.LittleEndian.PutUint32(acl, aclVersion)
+	for i, e := range []struct {
+		tag uint16
+		id  uint32
+	}{{0x01, 0xffffffff}, {aclUser, 100005}, {aclGroup, 5}} {
+		binary.LittleEndian.PutUint16(acl[4+i*8:], e.tag)
+		binary.LittleEndian.PutUint32(acl[4+i*8+4:], e.id)
+	}
+	if !s.remapACL(acl) {
+		t.Fatal("ACL with named user in source range is not changed")
+	}
+	for i, want := range []uint32{0xffffffff, 165541, 5} {
+		if got := binary.LittleEndian.Uint32(acl[4+i*8+4:]); got != want {
+			t.Errorf("ACL entry %d id = %d, want %d", i, got, want)
+		}
+	}
+	if s.remapACL(acl) {
+		t.Error("shifted ACL is changed again")
+	}
+}
+
+func TestShiftOwner(t *testing.T) {
+	if os.Geteuid() != 0 {
+		t.Skip("changing owners requires root")
+	}
+	dir, err := ioutil.TempDir("", "shift")
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer os.RemoveAll(dir)
+
+	os.MkdirAll(dir+"/a/b", 0755)
+	ioutil.WriteFile(dir+"/a/file", nil, 0644)
+	ioutil.WriteFile(dir+"/a/b/setuid", nil, 0755)
+	os.Symlink("file", dir+"/a/link")
+	os.Chown(dir+"/a/b/setuid", 100000, 100000)
+	syscall.Chmod(dir+"/a/b/setuid", 04755)
+	os.Lchown(dir+"/a/link", 100001, 100002)
+	os.Chown(dir+"/a/file", 5, 5)
+
+	for i := 0; i < 2; i++ {
+		if err := ShiftOwner(dir, 100000, 165536, 65536); err != nil {
+			t.Fatal(err)
+		}
+	}
+	for path, want := range map[string][2]uint32{
+		"/a/b/setuid": {165536, 165536},
+		"/a/link":     {165537, 165538},
+		"/a/file":     {5, 5},
+	} {
+		var st syscall.Stat_t
+		if err := syscall.Lstat(dir+path, &st); err != nil {
+			t.Fatal(err)
+		}
+		if st.Uid != want[0] || st.Gid != want[1] {
+			t.Errorf("%s is owned by %d:%d, want %d:%d", path, st.Uid, st.Gid, want[0], want[1])
+		}
+		if path == "/a/b/setuid" && st.Mode&syscall.S_ISUID == 0 {
+			t.Error("setuid bit is lost")
+		}
+	}
+
+	if err := ShiftOwner(dir, 100000, 100000+1000, 65536); err != errOverlap {
+		t.Errorf("overlapping ranges are not rejected: %v", err)
+	}
+}
+
+// tree returns synthetic tree of benchFiles files owned by the range starting from 100000, it's created once for all benchmarks.
+func tree(b *testing.B) string {
+	if os.Geteuid() != 0 {
+		b.Skip("changing owners requires root")
+	}
+	benchOnce.Do(func() {
+		dir, err := ioutil.TempDir("", "shiftbench")
+		if err != nil {
+			return
+		}
+		for d := 0; d < benchDirs; d++ {
+			sub := filepath.Join(dir, strconv.Itoa(d))
+			os.Mkdir(sub, 0755)
+			os.Chown(sub, 100000, 100000)
+			for f := 0; f < benchFiles/benchDirs; f++ {
+				file := filepath.Join(sub, strconv.Itoa(f))
+				ioutil.WriteFile(file, nil, 0644)
+				os.Chown(file, 100000+f%1000, 100000+f%1000)
+			}
+		}
+		benchDir = dir
+	})
+	if len(benchDir) == 0 {
+		b.Skip("can't create the tree")
+	}
+	return benchDir
+}
+
+// shiftBench shifts the tree back and forth between two ranges b.N times.
+func shiftBench(b *testing.B, shift func(dir string, from, to int) error) {
+	dir := tree(b)
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		from, to := 100000, 165536
+		if i%2 == 1 {
+			from, to = to, from
+		}
+		if err := shift(dir, from, to); err != nil {
+			b.Fatal(err)
+		}
+	}
+	b.StopTimer()
+	if b.N%2 == 1 {
+		shift(dir, 165536, 100000)
+	}
+}
+
+func BenchmarkShiftOwner(b *testing.B) {
+	shiftBench(b, func(dir string, from, to int) error {
+		return ShiftOwner(dir, from, to, 65536)
+	})
+}
+
+func BenchmarkUidmapshift(b *testing.B) {
+	if _, err := exec.LookPath("uidmapshift"); err != nil {
+		b.Skip("uidmapshift is not installed")
+	}
+	shiftBench(b, func(dir string, from, to int) error {
+		return exec.Command("uidmapshift", "-b", dir+"/", strconv.Itoa(from), strconv.Itoa(to), "65536").Run()
+	})
+}
@@ -100,7 +100,12 @@ func EncryptWrapper(user, recipient string, message []byte, args ...string) stri
 
 // GenerateKey generates GPG-key for Subutai Agent.
 // This key used for encrypting messages for Subutai Agent.
+// Container keys are built in-process from the pre-generated key pool.
 func GenerateKey(name string) {
+	if container.IsContainer(name) {
+		log.Check(log.FatalLevel, "Generating key", containerKey(name))
+		return
+	}
 	path := config.Agent.LxcPrefix + name
 	email := name + "@subutai.io"
 	pass := config.Agent.GpgPassword
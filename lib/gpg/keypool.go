@@ -0,0 +1,195 @@
+package gpg
+
+import (
+	"crypto"
+	"crypto/rand"
+	"crypto/rsa"
+	"crypto/x509"
+	"encoding/pem"
+	"io"
+	"io/ioutil"
+	"os"
+	"path/filepath"
+	"strconv"
+	"sync"
+	"time"
+
+	"golang.org/x/crypto/openpgp"
+	"golang.org/x/crypto/openpgp/packet"
+
+	"github.com/subutai-io/agent/config"
+	"github.com/subutai-io/agent/log"
+)
+
+// keyPoolDir returns directory keeping pre-generated RSA keys for containers.
+func keyPoolDir() string {
+	return config.Agent.DataPrefix + "keypool/"
+}
+
+// KeyPool keeps the pool of pre-generated container keys filled up to configured depth,
+// running configured number of generators in parallel. It's started by the daemon and never returns.
+func KeyPool() {
+	log.Check(log.WarnLevel, "Creating key pool directory", os.MkdirAll(keyPoolDir(), 0700))
+	for {
+		ready, size := KeyPoolStatus()
+		if missing := size - ready; missing > 0 {
+			workers := config.Agent.KeyPoolWorkers
+			if workers < 1 {
+				workers = 1
+			}
+			if workers > missing {
+				workers = missing
+			}
+			start := time.Now()
+			var wg sync.WaitGroup
+			for i := 0; i < workers; i++ {
+				wg.Add(1)
+				go func() {
+					defer wg.Done()
+					log.Check(log.WarnLevel, "Generating pooled key", poolKey())
+				}()
+			}
+			wg.Wait()
+			ready, _ = KeyPoolStatus()
+			log.Debug("Key pool: generated " + strconv.Itoa(workers) + " keys in " + time.Since(start).String() +
+				", " + strconv.Itoa(ready) + " of " + strconv.Itoa(size) + " ready")
+			continue
+		}
+		time.Sleep(10 * time.Second)
+	}
+}
+
+// KeyPoolStatus returns number of ready keys in the pool and configured pool depth.
+func KeyPoolStatus() (ready, size int) {
+	list, _ := filepath.Glob(keyPoolDir() + "*.pem")
+	return len(list), config.Agent.KeyPoolSize
+}
+
+// poolKey generates RSA key and puts it into the pool. File appears in the pool only when completely written.
+func poolKey() error {
+	key, err := rsa.GenerateKey(rand.Reader, 2048)
+	if err != nil {
+		return err
+	}
+	tmp, err := ioutil.TempFile(keyPoolDir(), ".key")
+	if err != nil {
+		return err
+	}
+	err = pem.Encode(tmp, &pem.Block{Type: "RSA PRIVATE KEY", Bytes: x509.MarshalPKCS1PrivateKey(key)})
+	if cerr := tmp.Close(); err == nil {
+		err = cerr
+	}
+	if err == nil {
+		err = os.Rename(tmp.Name(), tmp.Name()+".pem")
+	}
+	if err != nil {
+		os.Remove(tmp.Name())
+	}
+	return err
+}
+
+// takeKey removes a key from the pool and returns it. If the pool is empty, new key is generated in place.
+func takeKey() (*rsa.PrivateKey, error) {
+	list, _ := filepath.Glob(keyPoolDir() + "*.pem")
+	for _, file := range list {
+		// rename makes sure that concurrent clones never get the same key
+		taken := file + ".taken"
+		if os.Rename(file, taken) != nil {
+			continue
+		}
+		data, err := ioutil.ReadFile(taken)
+		os.Remove(taken)
+		if err != nil {
+			continue
+		}
+		if block, _ := pem.Decode(data); block != nil {
+			if key, err := x509.ParsePKCS1PrivateKey(block.Bytes); err == nil {
+				return key, nil
+			}
+		}
+	}
+	return rsa.GenerateKey(rand.Reader, 2048)
+}
+
+// containerKey writes the container keyrings with the key from the pool bound to the container identity.
+func containerKey(name string) error {
+	key, err := takeKey()
+	if err != nil {
+		return err
+	}
+
+	now := time.Now()
+	primary := true
+	uid := packet.NewUserId(name, name+" GPG key", name+"@subutai.io")
+	e := &openpgp.Entity{
+		PrimaryKey: packet.NewRSAPublicKey(now, &key.PublicKey),
+		PrivateKey: packet.NewRSAPrivateKey(now, key),
+		Identities: make(map[string]*openpgp.Identity),
+	}
+	// single key with all usages, same as "gpg --gen-key" with Key-Type RSA and no subkey
+	e.Identities[uid.Id] = &openpgp.Identity{
+		Name:   uid.Id,
+		UserId: uid,
+		SelfSignature: &packet.Signature{
+			CreationTime:              now,
+			SigType:                   packet.SigTypePositiveCert,
+			PubKeyAlgo:                packet.PubKeyAlgoRSA,
+			Hash:                      crypto.SHA256,
+			IsPrimaryId:               &primary,
+			FlagsValid:                true,
+			FlagSign:                  true,
+			FlagCertify:               true,
+			FlagEncryptStorage:        true,
+			FlagEncryptCommunications: true,
+			IssuerKeyId:               &e.PrimaryKey.KeyId,
+		},
+	}
+
+	path := config.Agent.LxcPrefix + name
+	sec, err := os.OpenFile(path+"/secret.sec", os.O_WRONLY|os.O_CREATE|os.O_TRUNC, 0600)
+	if err != nil {
+		return err
+	}
+	err = writeSecret(sec, e)
+	if cerr := sec.Close(); err == nil {
+		err = cerr
+	}
+	if err != nil {
+		return err
+	}
+
+	pub, err := os.OpenFile(path+"/public.pub", os.O_WRONLY|os.O_CREATE|os.O_TRUNC, 0644)
+	if err != nil {
+		return err
+	}
+	err = e.Serialize(pub)
+	if cerr := pub.Close(); err == nil {
+		err = cerr
+	}
+	return err
+}
+
+// writeSecret signs identities of the entity and writes its secret key protected with the agent GPG password,
+// as gpg batch generation does. Identities are signed before the key is encrypted, so the entity stays ready for Serialize.
+func writeSecret(w io.Writer, e *openpgp.Entity) error {
+	for _, ident := range e.Identities {
+		if err := ident.SelfSignature.SignUserId(ident.UserId.Id, e.PrimaryKey, e.PrivateKey, nil); err != nil {
+			return err
+		}
+	}
+	if err := e.PrivateKey.Encrypt([]byte(config.Agent.GpgPassword)); err != nil {
+		return err
+	}
+	if err := e.PrivateKey.Serialize(w); err != nil {
+		return err
+	}
+	for _, ident := range e.Identities {
+		if err := ident.UserId.Serialize(w); err != nil {
+			return err
+		}
+		if err := ident.SelfSignature.Serialize(w); err != nil {
+			return err
+		}
+	}
+	return nil
+}
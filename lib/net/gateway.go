@@ -1,6 +1,7 @@
 package net
 
 import (
+	"errors"
 	"io"
 	"io/ioutil"
 	"os"
@@ -13,11 +14,45 @@ import (
 // DelIface removes OVS bridges and ports by name, brings system interface down
 func DelIface(iface string) {
 	log.Debug("Removing interface " + iface)
+	log.Check(log.DebugLevel, "Removing traffic shaping of "+iface, unshape(iface))
+	if !log.Check(log.DebugLevel, "Removing interface over OVSDB", delIface(iface)) {
+		exec.Command("ifconfig", iface, "down").Run()
+		return
+	}
 	exec.Command("ovs-vsctl", "--if-exists", "del-br", iface).Run()
 	exec.Command("ovs-vsctl", "--if-exists", "del-port", iface).Run()
 	exec.Command("ifconfig", iface, "down").Run()
 }
 
+// delIface removes bridge or port with the name in single OVSDB transaction.
+// Ports and interfaces of removed bridge are collected by OVSDB server.
+func delIface(iface string) error {
+	o := ovsClient()
+	if o == nil {
+		return errors.New("OVSDB is not available")
+	}
+	res, err := o.transact(ovsSelect("Bridge", "name", iface, "_uuid"), ovsSelect("Port", "name", iface, "_uuid"))
+	if err != nil {
+		return err
+	}
+	var ops []ovsOp
+	if len(res[0].Rows) > 0 {
+		uuid := res[0].Rows[0]["_uuid"]
+		ops = append(ops,
+			ovsOp{"op": "mutate", "table": "Open_vSwitch", "where": []interface{}{},
+				"mutations": []interface{}{[]interface{}{"bridges", "delete", uuid}}},
+			ovsOp{"op": "delete", "table": "Bridge", "where": []interface{}{[]interface{}{"_uuid", "==", uuid}}})
+	} else if len(res[1].Rows) > 0 {
+		uuid := res[1].Rows[0]["_uuid"]
+		ops = append(ops, ovsOp{"op": "mutate", "table": "Bridge", "where": []interface{}{[]interface{}{"ports", "includes", uuid}},
+			"mutations": []interface{}{[]interface{}{"ports", "delete", uuid}}})
+	} else {
+		return nil
+	}
+	_, err = o.transact(append(ops, ovsCommit())...)
+	return err
+}
+
 // RestoreDefaultConf restores default values in "hosts" and "resolv.conf" inside container
 func RestoreDefaultConf(contName string) {
 	filePath := config.Agent.LxcPrefix + contName + "/rootfs/etc/"
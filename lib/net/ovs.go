@@ -4,6 +4,7 @@ package net
 import (
 	"bufio"
 	"bytes"
+	"errors"
 	"net"
 	"os/exec"
 	"strconv"
@@ -12,8 +13,23 @@ import (
 	"github.com/subutai-io/agent/log"
 )
 
-// RateLimit sets throughput limits for container's network interfaces if "quota" is specified
+// RateLimit sets throughput limits for container's network interfaces if "quota" is specified.
+// Traffic is shaped in both directions, OVS ingress policing is used only if shaping fails.
 func RateLimit(nic string, rate ...string) string {
+	if rate[0] != "" {
+		if r, err := strconv.Atoi(rate[0]); err == nil && !log.Check(log.DebugLevel, "Shaping traffic of "+nic, Shape(nic, r)) {
+			// policing left from the previous limit would drop the shaped traffic
+			rateLimit(nic, "0")
+			return strconv.Itoa(r)
+		}
+	} else if limit := ShapeRate(nic); limit != "" {
+		return limit
+	}
+
+	if limit, err := rateLimit(nic, rate[0]); !log.Check(log.DebugLevel, "Setting rate limit over OVSDB", err) {
+		return limit
+	}
+
 	if rate[0] != "" {
 		burst, _ := strconv.Atoi(rate[0])
 		burst = burst / 10
@@ -39,15 +55,44 @@ func RateLimit(nic string, rate ...string) string {
 	return ""
 }
 
-// GetIp returns IP address that should be used for host access
-func GetIp() string {
-	out, err := exec.Command("ovs-vsctl", "list-ports", "wan").Output()
-	log.Check(log.ErrorLevel, "Getting WAN ports", err)
+// rateLimit sets policing rate and burst and reads the resulting rate in single OVSDB transaction.
+func rateLimit(nic, rate string) (string, error) {
+	o := ovsClient()
+	if o == nil {
+		return "", errors.New("OVSDB is not available")
+	}
+	var ops []ovsOp
+	if rate != "" {
+		r, err := strconv.Atoi(rate)
+		if err != nil {
+			return "", err
+		}
+		ops = append(ops, ovsOp{"op": "update", "table": "Interface", "where": []interface{}{[]interface{}{"name", "==", nic}},
+			"row": map[string]interface{}{"ingress_policing_rate": r, "ingress_policing_burst": r / 10}}, ovsCommit())
+	}
+	ops = append(ops, ovsSelect("Interface", "name", nic, "ingress_policing_rate"))
+	res, err := o.transact(ops...)
+	if err != nil {
+		return "", err
+	}
+	if rows := res[len(ops)-1].Rows; len(rows) > 0 {
+		return atomString(rows[0]["ingress_policing_rate"]), nil
+	}
+	return "", nil
+}
+
+// wanAddr looks up the address of WAN interface, which is eth2 on hosts with eth1 attached to the wan bridge.
+func wanAddr() string {
+	ports, err := ListPorts("wan")
+	if log.Check(log.DebugLevel, "Listing WAN ports over OVSDB", err) {
+		out, err := exec.Command("ovs-vsctl", "list-ports", "wan").Output()
+		log.Check(log.ErrorLevel, "Getting WAN ports", err)
+		ports = strings.Split(string(out), "\n")
+	}
 
-	scanner := bufio.NewScanner(bytes.NewReader(out))
 	iface := "wan"
-	for scanner.Scan() {
-		if scanner.Text() == "eth1" {
+	for _, port := range ports {
+		if port == "eth1" {
 			iface = "eth2"
 			break
 		}
@@ -66,3 +111,130 @@ func GetIp() string {
 	}
 	return "null"
 }
+
+// Tunnel is VXLAN port of OVS bridge.
+type Tunnel struct {
+	Name   string
+	Remote string
+	Tag    string
+	VNI    string
+}
+
+// AddTunnel creates the bridge if it doesn't exist and adds VXLAN port to it, or updates the tag of existing port.
+// All changes are made in single OVSDB transaction.
+func AddTunnel(bridge, tunnel, remote, vni, tag string) error {
+	o := ovsClient()
+	if o == nil {
+		return addTunnelExec(bridge, tunnel, remote, vni, tag)
+	}
+	vlan, err := strconv.Atoi(tag)
+	if err != nil {
+		return err
+	}
+	res, err := o.transact(ovsSelect("Bridge", "name", bridge, "_uuid"), ovsSelect("Port", "name", tunnel, "_uuid"))
+	if err != nil {
+		return err
+	}
+
+	var ops []ovsOp
+	if len(res[0].Rows) == 0 {
+		ops = append(ops,
+			ovsOp{"op": "insert", "table": "Interface", "uuid-name": "briface", "row": map[string]interface{}{"name": bridge, "type": "internal"}},
+			ovsOp{"op": "insert", "table": "Port", "uuid-name": "brport", "row": map[string]interface{}{
+				"name": bridge, "interfaces": []interface{}{"named-uuid", "briface"}}},
+			ovsOp{"op": "insert", "table": "Bridge", "uuid-name": "br", "row": map[string]interface{}{
+				"name": bridge, "ports": []interface{}{"named-uuid", "brport"}}},
+			ovsOp{"op": "mutate", "table": "Open_vSwitch", "where": []interface{}{},
+				"mutations": []interface{}{[]interface{}{"bridges", "insert", []interface{}{"named-uuid", "br"}}}})
+	}
+	if len(res[1].Rows) == 0 {
+		options := []interface{}{"map", []interface{}{
+			[]interface{}{"key", vni}, []interface{}{"remote_ip", remote}, []interface{}{"stp_enable", "true"}}}
+		ops = append(ops,
+			ovsOp{"op": "insert", "table": "Interface", "uuid-name": "tuniface", "row": map[string]interface{}{
+				"name": tunnel, "type": "vxlan", "options": options}},
+			ovsOp{"op": "insert", "table": "Port", "uuid-name": "tunport", "row": map[string]interface{}{
+				"name": tunnel, "interfaces": []interface{}{"named-uuid", "tuniface"}, "tag": vlan}},
+			ovsOp{"op": "mutate", "table": "Bridge", "where": []interface{}{[]interface{}{"name", "==", bridge}},
+				"mutations": []interface{}{[]interface{}{"ports", "insert", []interface{}{"named-uuid", "tunport"}}}})
+	} else {
+		ops = append(ops, ovsOp{"op": "update", "table": "Port", "where": []interface{}{[]interface{}{"name", "==", tunnel}},
+			"row": map[string]interface{}{"tag": vlan}})
+	}
+	_, err = o.transact(append(ops, ovsCommit())...)
+	return err
+}
+
+func addTunnelExec(bridge, tunnel, remote, vni, tag string) error {
+	log.Check(log.WarnLevel, "Creating bridge ", exec.Command("ovs-vsctl", "--may-exist", "add-br", bridge).Run())
+	if err := exec.Command("ovs-vsctl", "--may-exist", "add-port", bridge, tunnel, "--", "set", "interface", tunnel, "type=vxlan",
+		"options:stp_enable=true", "options:key="+vni, "options:remote_ip="+remote).Run(); err != nil {
+		return err
+	}
+	return exec.Command("ovs-vsctl", "--if-exists", "set", "port", tunnel, "tag="+tag).Run()
+}
+
+// Tunnels returns VXLAN ports of OVS bridges.
+func Tunnels() ([]Tunnel, error) {
+	o := ovsClient()
+	if o == nil {
+		return tunnelsExec()
+	}
+	res, err := o.transact(ovsSelect("Interface", "type", "vxlan", "name", "options"),
+		ovsOp{"op": "select", "table": "Port", "where": []interface{}{}, "columns": []string{"name", "tag"}})
+	if err != nil {
+		return nil, err
+	}
+	tags := make(map[string]string)
+	for _, row := range res[1].Rows {
+		if tag := ovsSet(row["tag"]); len(tag) > 0 {
+			tags[atomString(row["name"])] = atomString(tag[0])
+		}
+	}
+	var list []Tunnel
+	for _, row := range res[0].Rows {
+		name := atomString(row["name"])
+		options := ovsMap(row["options"])
+		list = append(list, Tunnel{Name: name, Remote: options["remote_ip"], Tag: tags[name], VNI: options["key"]})
+	}
+	return list, nil
+}
+
+func tunnelsExec() ([]Tunnel, error) {
+	ret, err := exec.Command("ovs-vsctl", "show").CombinedOutput()
+	if err != nil {
+		return nil, err
+	}
+	var list []Tunnel
+	ports := strings.Split(string(ret), "\n")
+	for k, port := range ports {
+		if strings.Contains(port, "remote_ip") {
+			tunnel := strings.Trim(strings.Trim(ports[k-2], "Interface "), "\"")
+			tag := strings.TrimLeft(ports[k-3], "tag: ")
+			addr := strings.Fields(port)
+			vni := strings.Trim(strings.Trim(addr[1], "{key="), "\",")
+			ip := strings.Trim(strings.Trim(addr[2], "remote_ip="), "\",")
+			list = append(list, Tunnel{Name: tunnel, Remote: ip, Tag: tag, VNI: vni})
+		}
+	}
+	return list, nil
+}
+
+// DelPort removes the port from OVS bridge.
+func DelPort(bridge, port string) {
+	o := ovsClient()
+	if o != nil {
+		res, err := o.transact(ovsSelect("Port", "name", port, "_uuid"))
+		if err == nil && len(res[0].Rows) == 0 {
+			return
+		}
+		if err == nil {
+			_, err = o.transact(ovsOp{"op": "mutate", "table": "Bridge", "where": []interface{}{[]interface{}{"name", "==", bridge}},
+				"mutations": []interface{}{[]interface{}{"ports", "delete", res[0].Rows[0]["_uuid"]}}}, ovsCommit())
+		}
+		if !log.Check(log.DebugLevel, "Removing port over OVSDB", err) {
+			return
+		}
+	}
+	exec.Command("ovs-vsctl", "del-port", bridge, port).Run()
+}
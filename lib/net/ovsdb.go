@@ -0,0 +1,379 @@
+package net
+
+import (
+	"encoding/json"
+	"errors"
+	"net"
+	"strconv"
+	"sync"
+	"time"
+
+	"github.com/subutai-io/agent/log"
+)
+
+// ovsSockets are the paths of local OVSDB server socket.
+var ovsSockets = []string{"/var/run/openvswitch/db.sock", "/run/openvswitch/db.sock"}
+
+const ovsTimeout = 5 * time.Second
+
+// ovsMsg is a JSON-RPC 1.0 message of OVSDB protocol (RFC 7047).
+type ovsMsg struct {
+	Method string          `json:"method,omitempty"`
+	Params json.RawMessage `json:"params,omitempty"`
+	Result json.RawMessage `json:"result,omitempty"`
+	Error  interface{}     `json:"error,omitempty"`
+	ID     interface{}     `json:"id"`
+}
+
+// ovsReply is a response to the request of the server, error should be present even if it's null.
+type ovsReply struct {
+	Result json.RawMessage `json:"result"`
+	Error  interface{}     `json:"error"`
+	ID     interface{}     `json:"id"`
+}
+
+// ovsResult is the result of single operation of the transaction.
+type ovsResult struct {
+	Rows    []map[string]interface{} `json:"rows"`
+	UUID    interface{}              `json:"uuid"`
+	Count   int                      `json:"count"`
+	Error   string                   `json:"error"`
+	Details string                   `json:"details"`
+}
+
+// ovsOp is an operation of OVSDB transaction.
+type ovsOp map[string]interface{}
+
+// ovsdb is a connection to OVSDB server. Responses are read by separate goroutine,
+// so the connection can be shared by concurrent callers and receive monitor updates.
+type ovsdb struct {
+	conn    net.Conn
+	mu      sync.Mutex
+	enc     *json.Encoder
+	id      int
+	pending map[int]chan ovsMsg
+	update  func(json.RawMessage)
+	monitor int
+	done    chan struct{}
+}
+
+var (
+	ovsLock sync.Mutex
+	ovsConn *ovsdb
+)
+
+// dialOVS connects to local OVSDB server.
+func dialOVS(update func(json.RawMessage)) (*ovsdb, error) {
+	var err error
+	for _, path := range ovsSockets {
+		var conn net.Conn
+		if conn, err = net.DialTimeout("unix", path, ovsTimeout); err == nil {
+			o := &ovsdb{conn: conn, enc: json.NewEncoder(conn), pending: make(map[int]chan ovsMsg), update: update, done: make(chan struct{})}
+			go o.read()
+			return o, nil
+		}
+	}
+	return nil, err
+}
+
+// ovsClient returns shared connection to OVSDB server or nil if the server is not available,
+// callers fall back to ovs-vsctl in that case.
+func ovsClient() *ovsdb {
+	ovsLock.Lock()
+	defer ovsLock.Unlock()
+	if ovsConn != nil {
+		select {
+		case <-ovsConn.done:
+			ovsConn = nil
+		default:
+			return ovsConn
+		}
+	}
+	o, err := dialOVS(nil)
+	if log.Check(log.DebugLevel, "Connecting to OVSDB", err) {
+		return nil
+	}
+	ovsConn = o
+	return o
+}
+
+func (o *ovsdb) read() {
+	dec := json.NewDecoder(o.conn)
+	for {
+		var msg ovsMsg
+		if err := dec.Decode(&msg); err != nil {
+			o.conn.Close()
+			close(o.done)
+			return
+		}
+		switch msg.Method {
+		case "echo":
+			o.mu.Lock()
+			o.enc.Encode(ovsReply{Result: msg.Params, ID: msg.ID})
+			o.mu.Unlock()
+		case "update":
+			var params []json.RawMessage
+			if json.Unmarshal(msg.Params, &params) == nil && len(params) == 2 && o.update != nil {
+				o.update(params[1])
+			}
+		default:
+			if id, ok := msg.ID.(float64); ok {
+				o.mu.Lock()
+				ch := o.pending[int(id)]
+				delete(o.pending, int(id))
+				monitor := o.monitor == int(id)
+				o.mu.Unlock()
+				// initial state of monitored tables is applied here to keep the order with following updates
+				if monitor && msg.Error == nil && o.update != nil {
+					o.update(msg.Result)
+				}
+				if ch != nil {
+					ch <- msg
+				}
+			}
+		}
+	}
+}
+
+// call sends the request and waits for its result.
+func (o *ovsdb) call(method string, params ...interface{}) (json.RawMessage, error) {
+	p, err := json.Marshal(params)
+	if err != nil {
+		return nil, err
+	}
+	ch := make(chan ovsMsg, 1)
+	o.mu.Lock()
+	o.id++
+	id := o.id
+	o.pending[id] = ch
+	if method == "monitor" {
+		o.monitor = id
+	}
+	err = o.enc.Encode(ovsMsg{Method: method, Params: p, ID: id})
+	o.mu.Unlock()
+	if err != nil {
+		return nil, err
+	}
+
+	select {
+	case msg := <-ch:
+		if msg.Error != nil {
+			return nil, errors.New("OVSDB " + method + " failed: " + jsonString(msg.Error))
+		}
+		return msg.Result, nil
+	case <-o.done:
+		return nil, errors.New("OVSDB connection closed")
+	case <-time.After(ovsTimeout):
+		o.mu.Lock()
+		delete(o.pending, id)
+		o.mu.Unlock()
+		return nil, errors.New("OVSDB " + method + " timed out")
+	}
+}
+
+// transact runs operations in single transaction of Open_vSwitch database.
+func (o *ovsdb) transact(ops ...ovsOp) ([]ovsResult, error) {
+	params := []interface{}{"Open_vSwitch"}
+	for _, op := range ops {
+		params = append(params, op)
+	}
+	out, err := o.call("transact", params...)
+	if err != nil {
+		return nil, err
+	}
+	var results []ovsResult
+	if err = json.Unmarshal(out, &results); err != nil {
+		return nil, err
+	}
+	for _, r := range results {
+		if len(r.Error) != 0 {
+			return nil, errors.New("OVSDB transaction failed: " + r.Error + " " + r.Details)
+		}
+	}
+	if len(results) < len(ops) {
+		return nil, errors.New("OVSDB transaction is incomplete")
+	}
+	return results, nil
+}
+
+// ovsSelect builds select operation of the rows with the column equal to the value.
+func ovsSelect(table, column string, value interface{}, columns ...string) ovsOp {
+	op := ovsOp{"op": "select", "table": table, "where": []interface{}{[]interface{}{column, "==", value}}}
+	if len(columns) != 0 {
+		op["columns"] = columns
+	}
+	return op
+}
+
+// ovsCommit builds operation asking ovs-vswitchd to apply the changes, as ovs-vsctl does.
+func ovsCommit() ovsOp {
+	return ovsOp{"op": "mutate", "table": "Open_vSwitch", "where": []interface{}{},
+		"mutations": []interface{}{[]interface{}{"next_cfg", "+=", 1}}}
+}
+
+// ovsSet returns elements of OVSDB set, single atom is a set of one element.
+func ovsSet(v interface{}) []interface{} {
+	if a, ok := v.([]interface{}); ok && len(a) == 2 && a[0] == "set" {
+		list, _ := a[1].([]interface{})
+		return list
+	}
+	if v == nil {
+		return nil
+	}
+	return []interface{}{v}
+}
+
+// ovsUUID returns id of OVSDB uuid atom.
+func ovsUUID(v interface{}) string {
+	if a, ok := v.([]interface{}); ok && len(a) == 2 && (a[0] == "uuid" || a[0] == "named-uuid") {
+		id, _ := a[1].(string)
+		return id
+	}
+	return ""
+}
+
+// ovsMap returns OVSDB map of strings.
+func ovsMap(v interface{}) map[string]string {
+	m := make(map[string]string)
+	if a, ok := v.([]interface{}); ok && len(a) == 2 && a[0] == "map" {
+		pairs, _ := a[1].([]interface{})
+		for _, pair := range pairs {
+			if kv, ok := pair.([]interface{}); ok && len(kv) == 2 {
+				m[atomString(kv[0])] = atomString(kv[1])
+			}
+		}
+	}
+	return m
+}
+
+// atomString formats OVSDB atom as ovs-vsctl prints it.
+func atomString(v interface{}) string {
+	switch a := v.(type) {
+	case string:
+		return a
+	case float64:
+		return strconv.FormatInt(int64(a), 10)
+	case bool:
+		return strconv.FormatBool(a)
+	}
+	return ovsUUID(v)
+}
+
+func jsonString(v interface{}) string {
+	out, _ := json.Marshal(v)
+	return string(out)
+}
+
+// ovsBridge is a bridge row of the cache.
+type ovsBridge struct {
+	name  string
+	ports []string
+}
+
+// ovsCache keeps bridges and ports of OVSDB monitored by the daemon, rows are stored by uuid.
+var ovsCache struct {
+	sync.RWMutex
+	on      bool
+	bridges map[string]ovsBridge
+	ports   map[string]string
+}
+
+// OVSMonitor works as a daemon, keeping bridges and ports of local Open vSwitch in memory,
+// so frequent lookups like GetIp don't need to query the database.
+func OVSMonitor() {
+	for {
+		o, err := dialOVS(ovsUpdate)
+		if !log.Check(log.DebugLevel, "Connecting to OVSDB", err) {
+			ovsCache.Lock()
+			ovsCache.bridges = make(map[string]ovsBridge)
+			ovsCache.ports = make(map[string]string)
+			ovsCache.Unlock()
+
+			tables := map[string]interface{}{
+				"Bridge": map[string]interface{}{"columns": []string{"name", "ports"}},
+				"Port":   map[string]interface{}{"columns": []string{"name"}},
+			}
+			_, err := o.call("monitor", "Open_vSwitch", "agent", tables)
+			if !log.Check(log.WarnLevel, "Monitoring OVSDB", err) {
+				ovsCache.Lock()
+				ovsCache.on = true
+				ovsCache.Unlock()
+				<-o.done
+			}
+			o.conn.Close()
+			ovsCache.Lock()
+			ovsCache.on = false
+			ovsCache.Unlock()
+		}
+		time.Sleep(5 * time.Second)
+	}
+}
+
+// ovsUpdate applies table updates of the monitor to the cache.
+func ovsUpdate(data json.RawMessage) {
+	var updates map[string]map[string]struct {
+		New map[string]interface{} `json:"new"`
+	}
+	if json.Unmarshal(data, &updates) != nil {
+		return
+	}
+	ovsCache.Lock()
+	defer ovsCache.Unlock()
+	defer wanNotify()
+	for uuid, row := range updates["Port"] {
+		if row.New == nil {
+			delete(ovsCache.ports, uuid)
+		} else {
+			ovsCache.ports[uuid] = atomString(row.New["name"])
+		}
+	}
+	for uuid, row := range updates["Bridge"] {
+		if row.New == nil {
+			delete(ovsCache.bridges, uuid)
+			continue
+		}
+		b := ovsBridge{name: atomString(row.New["name"])}
+		for _, p := range ovsSet(row.New["ports"]) {
+			b.ports = append(b.ports, ovsUUID(p))
+		}
+		ovsCache.bridges[uuid] = b
+	}
+}
+
+// ListPorts returns names of the ports of the bridge.
+func ListPorts(bridge string) ([]string, error) {
+	ovsCache.RLock()
+	if ovsCache.on {
+		var list []string
+		for _, b := range ovsCache.bridges {
+			if b.name == bridge {
+				for _, uuid := range b.ports {
+					list = append(list, ovsCache.ports[uuid])
+				}
+			}
+		}
+		ovsCache.RUnlock()
+		return list, nil
+	}
+	ovsCache.RUnlock()
+
+	o := ovsClient()
+	if o == nil {
+		return nil, errors.New("OVSDB is not available")
+	}
+	res, err := o.transact(ovsSelect("Bridge", "name", bridge, "ports"), ovsOp{"op": "select", "table": "Port", "where": []interface{}{}, "columns": []string{"_uuid", "name"}})
+	if err != nil {
+		return nil, err
+	}
+	names := make(map[string]string)
+	for _, row := range res[1].Rows {
+		names[ovsUUID(row["_uuid"])] = atomString(row["name"])
+	}
+	var list []string
+	for _, row := range res[0].Rows {
+		for _, p := range ovsSet(row["ports"]) {
+			list = append(list, names[ovsUUID(p)])
+		}
+	}
+	return list, nil
+}
@@ -0,0 +1,194 @@
+package net
+
+import (
+	"encoding/json"
+	"net"
+	"os/exec"
+	"reflect"
+	"strconv"
+	"testing"
+)
+
+// benchPorts is the number of ports added and removed by the benchmarks, each of them makes two port operations.
+const benchPorts = 500
+
+func decode(t *testing.T, s string) interface{} {
+	var v interface{}
+	if err := json.Unmarshal([]byte(s), &v); err != nil {
+		t.Fatal(err)
+	}
+	return v
+}
+
+func TestOvsSet(t *testing.T) {
+	for in, want := range map[string][]interface{}{
+		`["set",[]]`:                          {},
+		`["set",[1,2]]`:                       {1.0, 2.0},
+		`["uuid","a"]`:                        {[]interface{}{"uuid", "a"}},
+		`["set",[["uuid","a"],["uuid","b"]]]`: {[]interface{}{"uuid", "a"}, []interface{}{"uuid", "b"}},
+		`"eth0"`:                              {"eth0"},
+		`null`:                                nil,
+	} {
+		got := ovsSet(decode(t, in))
+		if len(got) != len(want) || (len(want) != 0 && !reflect.DeepEqual(got, want)) {
+			t.Errorf("ovsSet(%s) = %v, want %v", in, got, want)
+		}
+	}
+}
+
+func TestOvsUUID(t *testing.T) {
+	for in, want := range map[string]string{
+		`["uuid","1b2c"]`:       "1b2c",
+		`["named-uuid","port"]`: "port",
+		`["set",[]]`:            "",
+		`"1b2c"`:                "",
+	} {
+		if got := ovsUUID(decode(t, in)); got != want {
+			t.Errorf("ovsUUID(%s) = %q, want %q", in, got, want)
+		}
+	}
+}
+
+func TestOvsMap(t *testing.T) {
+	got := ovsMap(decode(t, `["map",[["key","100"],["remote_ip","10.0.0.2"],["n",5],["on",true],["ref",["uuid","ab"]]]]`))
+	want := map[string]string{"key": "100", "remote_ip": "10.0.0.2", "n": "5", "on": "true", "ref": "ab"}
+	if !reflect.DeepEqual(got, want) {
+		t.Errorf("ovsMap = %v, want %v", got, want)
+	}
+	if got := ovsMap(decode(t, `["set",[]]`)); len(got) != 0 {
+		t.Errorf("ovsMap of a set = %v", got)
+	}
+}
+
+func TestOvsUpdate(t *testing.T) {
+	ovsCache.bridges = make(map[string]ovsBridge)
+	ovsCache.ports = make(map[string]string)
+
+	ovsUpdate(json.RawMessage(`{
+		"Port": {"p1": {"new": {"name": "eth0"}}, "p2": {"new": {"name": "vxlan1"}}},
+		"Bridge": {"b1": {"new": {"name": "wan", "ports": ["set", [["uuid", "p1"], ["uuid", "p2"]]]}},
+			"b2": {"new": {"name": "gw-100", "ports": ["uuid", "p2"]}}}}`))
+	if ovsCache.ports["p1"] != "eth0" || ovsCache.ports["p2"] != "vxlan1" {
+		t.Errorf("ports = %v", ovsCache.ports)
+	}
+	if b := ovsCache.bridges["b1"]; b.name != "wan" || !reflect.DeepEqual(b.ports, []string{"p1", "p2"}) {
+		t.Errorf("bridge b1 = %+v", b)
+	}
+	if b := ovsCache.bridges["b2"]; b.name != "gw-100" || !reflect.DeepEqual(b.ports, []string{"p2"}) {
+		t.Errorf("bridge b2 = %+v", b)
+	}
+
+	ovsUpdate(json.RawMessage(`{"Port": {"p2": {"old": {"name": "vxlan1"}}}, "Bridge": {"b2": {"old": {"name": "gw-100"}}}}`))
+	if _, ok := ovsCache.ports["p2"]; ok {
+		t.Error("deleted port is kept")
+	}
+	if _, ok := ovsCache.bridges["b2"]; ok {
+		t.Error("deleted bridge is kept")
+	}
+}
+
+// fakeOVS answers requests of the client on the other end of the pipe with the replies, in order.
+// Server echo request is sent first and must be answered by the client. The pipe has no buffer,
+// so the requests are read apart from writing the replies, as the kernel does for the socket.
+func fakeOVS(t *testing.T, replies ...string) *ovsdb {
+	client, server := net.Pipe()
+	o := &ovsdb{conn: client, enc: json.NewEncoder(client), pending: make(map[int]chan ovsMsg), done: make(chan struct{})}
+	go o.read()
+
+	requests := make(chan ovsMsg, 16)
+	go func() {
+		defer close(requests)
+		dec := json.NewDecoder(server)
+		for {
+			var msg ovsMsg
+			if dec.Decode(&msg) != nil {
+				return
+			}
+			requests <- msg
+		}
+	}()
+	go func() {
+		defer server.Close()
+		enc := json.NewEncoder(server)
+		enc.Encode(ovsMsg{Method: "echo", Params: json.RawMessage(`[]`), ID: "echo"})
+		echoed := false
+		for msg := range requests {
+			if len(msg.Method) == 0 {
+				echoed = msg.ID == "echo"
+			} else {
+				enc.Encode(ovsMsg{Result: json.RawMessage(replies[0]), ID: msg.ID})
+				replies = replies[1:]
+			}
+			if echoed && len(replies) == 0 {
+				return
+			}
+		}
+	}()
+	return o
+}
+
+func TestTransact(t *testing.T) {
+	o := fakeOVS(t,
+		`[{"rows":[{"_uuid":["uuid","b1"],"ports":["uuid","p1"]}]},{"count":1}]`,
+		`[{"count":0},{"error":"constraint violation","details":"duplicate name"}]`,
+		`[{"count":1}]`)
+
+	res, err := o.transact(ovsSelect("Bridge", "name", "wan", "ports"), ovsCommit())
+	if err != nil {
+		t.Fatal(err)
+	}
+	if len(res) != 2 || ovsUUID(res[0].Rows[0]["_uuid"]) != "b1" || res[1].Count != 1 {
+		t.Errorf("results = %+v", res)
+	}
+
+	if _, err = o.transact(ovsSelect("Port", "name", "p", "_uuid"), ovsCommit()); err == nil {
+		t.Error("failed operation is not reported")
+	}
+	if _, err = o.transact(ovsSelect("Port", "name", "p", "_uuid"), ovsCommit()); err == nil {
+		t.Error("incomplete transaction is not reported")
+	}
+	if _, err = o.transact(ovsCommit()); err == nil {
+		t.Error("closed connection is not reported")
+	}
+}
+
+// benchBridge skips the benchmark if Open vSwitch is not available and removes the bridge after it.
+func benchBridge(b *testing.B) string {
+	if ovsClient() == nil {
+		b.Skip("OVSDB is not available")
+	}
+	if _, err := exec.LookPath("ovs-vsctl"); err != nil {
+		b.Skip("ovs-vsctl is not installed")
+	}
+	bridge := "benchbr0"
+	b.Cleanup(func() { exec.Command("ovs-vsctl", "--if-exists", "del-br", bridge).Run() })
+	return bridge
+}
+
+func BenchmarkPortsOVSDB(b *testing.B) {
+	bridge := benchBridge(b)
+	for i := 0; i < b.N; i++ {
+		for p := 0; p < benchPorts; p++ {
+			if err := AddTunnel(bridge, "bench"+strconv.Itoa(p), "10.0.0.1", "100", "1"); err != nil {
+				b.Fatal(err)
+			}
+		}
+		for p := 0; p < benchPorts; p++ {
+			DelPort(bridge, "bench"+strconv.Itoa(p))
+		}
+	}
+}
+
+func BenchmarkPortsVsctl(b *testing.B) {
+	bridge := benchBridge(b)
+	for i := 0; i < b.N; i++ {
+		for p := 0; p < benchPorts; p++ {
+			if err := addTunnelExec(bridge, "bench"+strconv.Itoa(p), "10.0.0.1", "100", "1"); err != nil {
+				b.Fatal(err)
+			}
+		}
+		for p := 0; p < benchPorts; p++ {
+			exec.Command("ovs-vsctl", "del-port", bridge, "bench"+strconv.Itoa(p)).Run()
+		}
+	}
+}
@@ -33,38 +33,81 @@ func Remove(hash string) {
 	log.Check(log.WarnLevel, "Removing p2p interface", exec.Command("p2p", "stop", "-hash", hash).Run())
 }
 
-// RemoveByIface deletes P2P interface from the Resource Host.
-func RemoveByIface(name string) {
-	mac := ""
+// RemoveByIface deletes P2P interfaces from the Resource Host and removes their iptables rules in single transaction.
+func RemoveByIface(names ...string) {
+	macs := make(map[string]bool)
 	interfaces, _ := net.Interfaces()
 	for _, iface := range interfaces {
-		if iface.Name == name {
-			mac = iface.HardwareAddr.String()
+		for _, name := range names {
+			if iface.Name == name {
+				macs[iface.HardwareAddr.String()] = true
+			}
 		}
 	}
 	out, _ := exec.Command("p2p", "show").Output()
 	scanner := bufio.NewScanner(bytes.NewReader(out))
 	for scanner.Scan() {
 		line := strings.Fields(scanner.Text())
-		if len(line) > 1 && line[0] == mac {
+		if len(line) > 2 && macs[line[0]] {
 			Remove(line[2])
 		}
 	}
-	iptablesCleanUp(name)
+	log.Check(log.WarnLevel, "Removing iptables rules of p2p interfaces", iptablesCleanUp(names...))
 }
 
-// iptablesCleanUp removes Iptables rules applied for passed interface
-func iptablesCleanUp(name string) {
-	out, _ := exec.Command("iptables-save").Output()
+// iptablesCleanUp removes iptables rules applied for passed interfaces. Rules of all tables are read with single iptables-save
+// and deleted with single iptables-restore, which applies each table atomically.
+func iptablesCleanUp(names ...string) error {
+	out, err := exec.Command("iptables-save").Output()
+	if err != nil {
+		return err
+	}
+	ifaces := make(map[string]bool)
+	for _, name := range names {
+		ifaces[name] = true
+	}
+
+	var rules bytes.Buffer
+	var table []string
+	flush := func() {
+		if len(table) > 1 {
+			rules.WriteString(strings.Join(table, "\n") + "\nCOMMIT\n")
+		}
+		table = nil
+	}
 	scanner := bufio.NewScanner(bytes.NewReader(out))
 	for scanner.Scan() {
 		line := scanner.Text()
-		if strings.Contains(line, name) {
-			args := strings.Fields(line)
-			args[0] = "-D"
-			exec.Command("iptables", append([]string{"-t", "nat"}, args...)...).Run()
+		switch {
+		case strings.HasPrefix(line, "*"):
+			flush()
+			table = []string{line}
+		case line == "COMMIT":
+			flush()
+		case strings.HasPrefix(line, "-A ") && table != nil && ruleOf(line, ifaces):
+			table = append(table, "-D"+line[2:])
+		}
+	}
+	if rules.Len() == 0 {
+		return nil
+	}
+	cmd := exec.Command("iptables-restore", "--noflush")
+	cmd.Stdin = &rules
+	if out, err := cmd.CombinedOutput(); err != nil {
+		return fmt.Errorf("%v: %s", err, out)
+	}
+	return nil
+}
+
+// ruleOf checks if the rule references one of the interfaces. Whole arguments are compared,
+// so rules of p2p10 are kept when p2p1 is removed.
+func ruleOf(rule string, ifaces map[string]bool) bool {
+	for _, arg := range strings.Fields(rule) {
+		if ifaces[strings.Trim(arg, "\"")] {
+			return true
 		}
 	}
+	return false
 }
 
 // UpdateKey sets new encryption key for the P2P instance to replace it during work.
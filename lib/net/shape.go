@@ -0,0 +1,125 @@
+package net
+
+import (
+	"strconv"
+	"syscall"
+
+	"github.com/vishvananda/netlink"
+)
+
+var (
+	// htbRoot is the handle of HTB qdisc, htbClass is the only class of it carrying all the traffic
+	htbRoot  = netlink.MakeHandle(1, 0)
+	htbClass = netlink.MakeHandle(1, 1)
+	ingress  = netlink.MakeHandle(0xffff, 0)
+)
+
+// Shape limits the traffic of the interface to the rate in Kbps in both directions, zero rate removes the limits.
+// Egress of the interface is shaped by HTB class with fq_codel queue, so the flows are delayed and fairly scheduled
+// instead of being dropped as OVS policing does. Ingress is redirected to IFB device and shaped on its egress.
+// On the host side of container veth egress is the traffic received by the container and ingress is the traffic it sends.
+// Partially applied limits are removed on failure, so the caller can fall back to OVS policing.
+func Shape(iface string, rate int) error {
+	if rate <= 0 {
+		return unshape(iface)
+	}
+	link, err := netlink.LinkByName(iface)
+	if err != nil {
+		return err
+	}
+	if err = shapeEgress(link, rate); err != nil {
+		unshape(iface)
+		return err
+	}
+	if err = shapeIngress(link, rate); err != nil {
+		unshape(iface)
+	}
+	return err
+}
+
+// shapeIngress redirects ingress of the link to its IFB device, created if it's missing, and shapes egress of the device.
+func shapeIngress(link netlink.Link, rate int) error {
+	ifb := ifbName(link.Attrs().Name)
+	l, err := netlink.LinkByName(ifb)
+	if err != nil {
+		if err = netlink.LinkAdd(&netlink.Ifb{LinkAttrs: netlink.LinkAttrs{Name: ifb}}); err != nil {
+			return err
+		}
+		if l, err = netlink.LinkByName(ifb); err != nil {
+			return err
+		}
+	}
+	if err = netlink.LinkSetUp(l); err != nil {
+		return err
+	}
+	if err = shapeEgress(l, rate); err != nil {
+		return err
+	}
+	idx := link.Attrs().Index
+	if err = netlink.QdiscReplace(&netlink.Ingress{QdiscAttrs: netlink.QdiscAttrs{LinkIndex: idx, Handle: ingress, Parent: netlink.HANDLE_INGRESS}}); err != nil {
+		return err
+	}
+	return netlink.FilterReplace(&netlink.U32{
+		FilterAttrs: netlink.FilterAttrs{LinkIndex: idx, Parent: ingress, Priority: 1, Protocol: syscall.ETH_P_ALL},
+		ClassId:     htbClass,
+		RedirIndex:  l.Attrs().Index,
+	})
+}
+
+// unshape removes the limits of the interface and its IFB device, which is left after the interface is removed.
+func unshape(iface string) error {
+	if link, err := netlink.LinkByName(iface); err == nil {
+		idx := link.Attrs().Index
+		netlink.QdiscDel(&netlink.Ingress{QdiscAttrs: netlink.QdiscAttrs{LinkIndex: idx, Handle: ingress, Parent: netlink.HANDLE_INGRESS}})
+		netlink.QdiscDel(netlink.NewHtb(netlink.QdiscAttrs{LinkIndex: idx, Handle: htbRoot, Parent: netlink.HANDLE_ROOT}))
+	}
+	if l, err := netlink.LinkByName(ifbName(iface)); err == nil {
+		return netlink.LinkDel(l)
+	}
+	return nil
+}
+
+// shapeEgress replaces root qdisc of the link with HTB limited to the rate in Kbps and fq_codel leaf.
+func shapeEgress(link netlink.Link, rate int) error {
+	idx := link.Attrs().Index
+	htb := netlink.NewHtb(netlink.QdiscAttrs{LinkIndex: idx, Handle: htbRoot, Parent: netlink.HANDLE_ROOT})
+	htb.Defcls = 1
+	if err := netlink.QdiscReplace(htb); err != nil {
+		return err
+	}
+	bits := uint64(rate) * 1000
+	class := netlink.NewHtbClass(netlink.ClassAttrs{LinkIndex: idx, Handle: htbClass, Parent: htbRoot},
+		netlink.HtbClassAttrs{Rate: bits, Ceil: bits})
+	if err := netlink.ClassReplace(class); err != nil {
+		return err
+	}
+	return netlink.QdiscReplace(netlink.NewFqCodel(netlink.QdiscAttrs{LinkIndex: idx, Handle: netlink.MakeHandle(10, 0), Parent: htbClass}))
+}
+
+// ShapeRate returns the rate in Kbps the interface is shaped to, empty string if it's not shaped.
+func ShapeRate(iface string) string {
+	link, err := netlink.LinkByName(iface)
+	if err != nil {
+		return ""
+	}
+	classes, err := netlink.ClassList(link, htbRoot)
+	if err != nil {
+		return ""
+	}
+	for _, c := range classes {
+		if htb, ok := c.(*netlink.HtbClass); ok && c.Attrs().Handle == htbClass {
+			// kernel reports the rate in bytes per second
+			return strconv.FormatUint(htb.Rate*8/1000, 10)
+		}
+	}
+	return ""
+}
+
+// ifbName returns the name of IFB device shaping received traffic of the interface, limited by IFNAMSIZ.
+func ifbName(iface string) string {
+	name := "ifb" + iface
+	if len(name) > 15 {
+		name = name[:15]
+	}
+	return name
+}
@@ -0,0 +1,46 @@
+package net
+
+import (
+	"bufio"
+	"os"
+	"strconv"
+	"strings"
+)
+
+// loopback addresses as they are printed in /proc/net tables
+var loopback = map[string]bool{
+	"0100007F":                         true,
+	"00000000000000000000000001000000": true,
+}
+
+// Listeners returns ports of listening TCP and bound UDP sockets of the host by protocol,
+// read from /proc/net tables. Sockets bound to loopback addresses are skipped unless local is set.
+func Listeners(local bool) map[string]map[int]bool {
+	ports := map[string]map[int]bool{"tcp": {}, "udp": {}}
+	for _, table := range []string{"tcp", "tcp6", "udp", "udp6"} {
+		f, err := os.Open("/proc/net/" + table)
+		if err != nil {
+			continue
+		}
+		proto := strings.TrimSuffix(table, "6")
+		scanner := bufio.NewScanner(f)
+		scanner.Scan()
+		for scanner.Scan() {
+			// sl local_address rem_address st ...
+			line := strings.Fields(scanner.Text())
+			// only listening tcp (0A) and unconnected udp (07) sockets, same as "netstat -l"
+			if len(line) < 4 || (proto == "tcp" && line[3] != "0A") || (proto == "udp" && line[3] != "07") {
+				continue
+			}
+			socket := strings.Split(line[1], ":")
+			if len(socket) != 2 || (!local && loopback[socket[0]]) {
+				continue
+			}
+			if port, err := strconv.ParseInt(socket[1], 16, 32); err == nil {
+				ports[proto][int(port)] = true
+			}
+		}
+		f.Close()
+	}
+	return ports
+}
@@ -0,0 +1,109 @@
+package net
+
+import (
+	"sync/atomic"
+	"syscall"
+	"time"
+
+	"github.com/subutai-io/agent/db"
+	"github.com/subutai-io/agent/log"
+)
+
+// rtmgrpIPv4Ifaddr is the legacy netlink multicast group mask of RTNLGRP_IPV4_IFADDR
+const rtmgrpIPv4Ifaddr = 0x10
+
+var (
+	// wanIP holds the host address maintained by WatchIp, it's read without locking
+	wanIP atomic.Value
+	// wanChanged wakes WatchIp up on address and OVS port changes
+	wanChanged = make(chan struct{}, 1)
+)
+
+// Wan serves the host address kept by the daemon to the commands.
+type Wan struct{}
+
+// Ip returns the host address.
+func (w *Wan) Ip(_ bool, ip *string) error {
+	var ok bool
+	if *ip, ok = wanIP.Load().(string); !ok {
+		*ip = wanAddr()
+	}
+	return nil
+}
+
+// GetIp returns IP address that should be used for host access.
+// The daemon keeps it in memory, commands ask the daemon and look it up themselves only if the daemon is not running.
+func GetIp() string {
+	if ip, ok := wanIP.Load().(string); ok {
+		return ip
+	}
+	if c, err := db.Dial(); err == nil {
+		defer c.Close()
+		var ip string
+		if c.Call("Wan.Ip", true, &ip) == nil && len(ip) != 0 {
+			return ip
+		}
+	}
+	return wanAddr()
+}
+
+// WatchIp works as a daemon, updating the host address on IPv4 address changes reported by netlink
+// and on changes of OVS ports.
+func WatchIp() {
+	wanIP.Store(wanAddr())
+	go func() {
+		for {
+			log.Check(log.WarnLevel, "Watching address changes", subscribeAddr())
+			time.Sleep(5 * time.Second)
+		}
+	}()
+	for range wanChanged {
+		if ip := wanAddr(); ip != wanIP.Load().(string) {
+			log.Debug("Host address changed to " + ip)
+			wanIP.Store(ip)
+		}
+	}
+}
+
+// wanNotify asks WatchIp to look up the address again.
+func wanNotify() {
+	select {
+	case wanChanged <- struct{}{}:
+	default:
+	}
+}
+
+// subscribeAddr listens to RTNLGRP_IPV4_IFADDR netlink group until an error occurs.
+func subscribeAddr() error {
+	fd, err := syscall.Socket(syscall.AF_NETLINK, syscall.SOCK_RAW|syscall.SOCK_CLOEXEC, syscall.NETLINK_ROUTE)
+	if err != nil {
+		return err
+	}
+	defer syscall.Close(fd)
+	if err = syscall.Bind(fd, &syscall.SockaddrNetlink{Family: syscall.AF_NETLINK, Groups: rtmgrpIPv4Ifaddr}); err != nil {
+		return err
+	}
+	// address may change between the lookup and subscription
+	wanNotify()
+
+	buf := make([]byte, syscall.Getpagesize()*4)
+	for {
+		n, _, err := syscall.Recvfrom(fd, buf, 0)
+		if err != nil {
+			if err == syscall.EINTR {
+				continue
+			}
+			return err
+		}
+		msgs, err := syscall.ParseNetlinkMessage(buf[:n])
+		if err != nil {
+			return err
+		}
+		for _, m := range msgs {
+			if m.Header.Type == syscall.RTM_NEWADDR || m.Header.Type == syscall.RTM_DELADDR {
+				wanNotify()
+				break
+			}
+		}
+	}
+}
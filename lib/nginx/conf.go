@@ -0,0 +1,230 @@
+// Package nginx renders reverse proxy and port mapping configs from the database and reloads nginx.
+package nginx
+
+import (
+	"io/ioutil"
+	"os"
+	"path/filepath"
+	"strconv"
+	"strings"
+
+	"github.com/subutai-io/agent/config"
+	"github.com/subutai-io/agent/db"
+)
+
+// marker is the line of the upstream block in templates after which backends are added.
+const marker = "#Add new host here"
+
+// conf is a config being rendered from the template.
+type conf struct {
+	lines []string
+}
+
+func load(tmpl string) (*conf, error) {
+	data, err := ioutil.ReadFile(config.Agent.AppPrefix + "etc/nginx/tmpl/" + tmpl)
+	if err != nil {
+		return nil, err
+	}
+	return &conf{lines: strings.Split(string(data), "\n")}, nil
+}
+
+// add puts the line after each line containing the pattern or replaces such lines.
+func (c *conf) add(after, line string, replace bool) {
+	for k, v := range c.lines {
+		if strings.Contains(v, after) {
+			if replace {
+				c.lines[k] = line
+			} else {
+				c.lines[k] = after + "\n" + line
+			}
+		}
+	}
+	c.lines = strings.Split(strings.Join(c.lines, "\n"), "\n")
+}
+
+// del removes lines containing the pattern.
+func (c *conf) del(line string) {
+	var lines []string
+	for _, v := range c.lines {
+		if !strings.Contains(v, line) {
+			lines = append(lines, v)
+		}
+	}
+	c.lines = lines
+}
+
+// write replaces the file atomically, so nginx never reads partially written config.
+func (c *conf) write(path string) error {
+	if err := os.MkdirAll(filepath.Dir(path), 0755); err != nil {
+		return err
+	}
+	tmp, err := ioutil.TempFile(filepath.Dir(path), "."+filepath.Base(path))
+	if err != nil {
+		return err
+	}
+	_, err = tmp.WriteString(strings.Join(c.lines, "\n"))
+	if cerr := tmp.Close(); err == nil {
+		err = cerr
+	}
+	if err == nil {
+		err = os.Chmod(tmp.Name(), 0644)
+	}
+	if err == nil {
+		err = os.Rename(tmp.Name(), path)
+	}
+	if err != nil {
+		os.Remove(tmp.Name())
+	}
+	return err
+}
+
+// backends returns health states of the nodes.
+func backends() map[string]db.Backend {
+	bolt, err := db.New()
+	if err != nil {
+		return nil
+	}
+	defer bolt.Close()
+	return bolt.Backends()
+}
+
+// server returns upstream server directive of the node with the weight and availability set by health checks.
+func server(node string, state map[string]db.Backend) string {
+	s := "server " + node
+	if b, ok := state[node]; ok {
+		if b.Weight > 1 {
+			s += " weight=" + strconv.Itoa(b.Weight)
+		}
+		if b.Down {
+			s += " down"
+		}
+	}
+	return s
+}
+
+// MapPath returns the path of port mapping config.
+func MapPath(protocol, port string) string {
+	return config.Agent.DataPrefix + "nginx-includes/" + protocol + "/" + port + ".conf"
+}
+
+// CertPath returns the path of certificate and key of https port mapping without extension.
+func CertPath(port string) string {
+	return config.Agent.DataPrefix + "web/ssl/https-" + port
+}
+
+// MapPolicy returns balancing directive of the port mapping policy or empty string if policy is not supported by the protocol.
+func MapPolicy(protocol, policy string) string {
+	switch policy {
+	case "round-robin":
+		return "#round-robin"
+	case "least_time":
+		if protocol == "tcp" {
+			return policy + " connect"
+		}
+		return policy + " header"
+	case "hash":
+		return policy + " $remote_addr"
+	case "ip_hash":
+		if protocol == "http" {
+			return policy
+		}
+	}
+	return ""
+}
+
+// WriteMap renders the config of the port mapping. Config of the mapping without backends is removed.
+func WriteMap(m db.Mapping) error {
+	path := MapPath(m.Protocol, m.External)
+	if len(m.Nodes) == 0 {
+		if err := os.Remove(path); !os.IsNotExist(err) {
+			return err
+		}
+		return nil
+	}
+
+	tmpl := map[string]string{"https": "vhost-ssl.example", "http": "vhost.example", "tcp": "stream.example", "udp": "stream.example"}
+	c, err := load(tmpl[m.Protocol])
+	if err != nil {
+		return err
+	}
+	upstream := m.Protocol + "-" + m.External
+	switch m.Protocol {
+	case "https":
+		c.add("listen      80;", "	listen "+m.External+";", true)
+		c.add("listen	443;", "	listen "+m.External+";", true)
+		c.add("server_name DOMAIN;", "server_name "+m.Domain+";", true)
+		c.add("proxy_pass http://DOMAIN-upstream/;", "	proxy_pass http://"+upstream+";", true)
+		c.add("upstream DOMAIN-upstream {", "upstream "+upstream+" {", true)
+		c.add("ssl_certificate /var/snap/subutai/current/web/ssl/UNIXDATE.crt;",
+			"ssl_certificate "+CertPath(m.External)+".crt;", true)
+		c.add("ssl_certificate_key /var/snap/subutai/current/web/ssl/UNIXDATE.key;",
+			"ssl_certificate_key "+CertPath(m.External)+".key;", true)
+	case "http":
+		c.add("listen 	80;", "	listen "+m.External+";", true)
+		c.add("server_name DOMAIN;", "server_name "+m.Domain+";", true)
+		c.add("proxy_pass http://DOMAIN-upstream/;", "	proxy_pass http://"+upstream+";", true)
+		c.add("upstream DOMAIN-upstream {", "upstream "+upstream+" {", true)
+	case "tcp":
+		c.add("listen PORT;", "	listen "+m.External+";", true)
+	case "udp":
+		c.add("listen PORT;", "	listen "+m.External+" udp;", true)
+	}
+	c.add("server localhost:81;", " ", true)
+	c.add("upstream PROTO-PORT {", "upstream "+upstream+" {", true)
+	c.add("proxy_pass PROTO-PORT;", "	proxy_pass "+upstream+";", true)
+
+	state := backends()
+	for _, node := range m.Nodes {
+		c.add(marker, "	"+server(node, state)+";", false)
+	}
+	if policy := MapPolicy(m.Protocol, m.Policy); len(policy) != 0 {
+		c.add("upstream "+upstream+" {", "	"+policy+"; #policy", false)
+	}
+	return c.write(path)
+}
+
+// ProxyPath returns the path of the environment domain config.
+func ProxyPath(vlan string) string {
+	return config.Agent.DataPrefix + "nginx-includes/http/" + vlan + ".conf"
+}
+
+// WriteProxy renders the config of the environment domain. Config is removed if the domain is not set.
+func WriteProxy(p db.Proxy) error {
+	path := ProxyPath(p.Vlan)
+	if len(p.Domain) == 0 {
+		if err := os.Remove(path); !os.IsNotExist(err) {
+			return err
+		}
+		return nil
+	}
+
+	tmpl := "vhost.example"
+	if len(p.Cert) != 0 {
+		tmpl = "vhost-ssl.example"
+	}
+	c, err := load(tmpl)
+	if err != nil {
+		return err
+	}
+	if len(p.Cert) != 0 {
+		c.add("ssl_certificate /var/snap/subutai/current/web/ssl/UNIXDATE.crt;",
+			"	ssl_certificate "+p.Cert+".crt;", true)
+		c.add("ssl_certificate_key /var/snap/subutai/current/web/ssl/UNIXDATE.key;",
+			"	ssl_certificate_key "+p.Cert+".key;", true)
+	}
+	c.add("upstream DOMAIN-upstream {", "upstream "+p.Domain+"-upstream {", true)
+	c.add("server_name DOMAIN;", "	server_name "+p.Domain+";", true)
+	c.add("proxy_pass http://DOMAIN-upstream/;", "	proxy_pass http://"+p.Domain+"-upstream/;", true)
+
+	if len(p.Policy) != 0 {
+		c.add(marker, "	"+p.Policy, false)
+	}
+	if len(p.Nodes) != 0 {
+		c.del("server localhost:81;")
+	}
+	state := backends()
+	for _, node := range p.Nodes {
+		c.add(marker, "	"+server(node, state)+"; #$node", false)
+	}
+	return c.write(path)
+}
@@ -0,0 +1,76 @@
+package nginx
+
+import (
+	"errors"
+	"os/exec"
+	"sync"
+	"time"
+
+	"github.com/subutai-io/agent/db"
+	"github.com/subutai-io/agent/log"
+)
+
+const (
+	reloadDelay    = 2 * time.Second
+	reloadMaxDelay = 10 * time.Second
+)
+
+// Reloader coalesces reload requests of the commands. It is served by the daemon,
+// so a series of changes, like destroying of the environment with many mappings, ends up in a single reload.
+type Reloader struct {
+	mu    sync.Mutex
+	timer *time.Timer
+	first time.Time
+}
+
+// Request schedules nginx reload after reloadDelay without new requests, but not later than reloadMaxDelay after the first one.
+func (r *Reloader) Request(_ bool, _ *bool) error {
+	r.mu.Lock()
+	defer r.mu.Unlock()
+	if r.timer == nil {
+		r.first = time.Now()
+		r.timer = time.AfterFunc(reloadDelay, r.fire)
+	} else if time.Since(r.first)+reloadDelay < reloadMaxDelay {
+		r.timer.Reset(reloadDelay)
+	}
+	return nil
+}
+
+func (r *Reloader) fire() {
+	r.mu.Lock()
+	r.timer = nil
+	r.mu.Unlock()
+	log.Check(log.WarnLevel, "Reloading nginx", reload())
+}
+
+// test validates nginx configuration.
+func test() error {
+	if out, err := exec.Command("nginx.sh", "-t").CombinedOutput(); err != nil {
+		return errors.New("Configuration test failed: " + string(out))
+	}
+	return nil
+}
+
+// reload validates configs and reloads nginx. Running nginx keeps previous configuration if validation fails.
+func reload() error {
+	if err := test(); err != nil {
+		return err
+	}
+	return exec.Command("nginx.sh", "-s", "reload").Run()
+}
+
+// Reload asks the daemon to reload nginx. Without the daemon nginx is reloaded immediately.
+// Configuration is validated by the caller before the request, so broken configuration is reported to it
+// instead of being only logged by the daemon.
+func Reload() error {
+	if c, err := db.Dial(); err == nil {
+		defer c.Close()
+		if err = test(); err != nil {
+			return err
+		}
+		if c.Call("Reloader.Request", true, new(bool)) == nil {
+			return nil
+		}
+	}
+	return reload()
+}
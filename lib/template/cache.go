@@ -0,0 +1,158 @@
+package template
+
+import (
+	"encoding/json"
+	"io/ioutil"
+	"os"
+	"sort"
+	"syscall"
+	"time"
+
+	"github.com/subutai-io/agent/config"
+	"github.com/subutai-io/agent/lib/container"
+	"github.com/subutai-io/agent/log"
+)
+
+// cacheGrace is the time archives added or used recently are kept for, so the archives prefetched for the import
+// which is still running are not evicted by each other. The size of the cache may exceed the limit for this time.
+const cacheGrace = time.Hour
+
+// cacheEntry is template archive kept in tmpdir.
+type cacheEntry struct {
+	Name string `json:"name"`
+	File string `json:"file"`
+	Size int64  `json:"size"`
+	Used int64  `json:"used"`
+	// Shared archives are verified downloads of public templates, only they are served to other resource hosts
+	Shared bool `json:"shared,omitempty"`
+}
+
+// withCache runs f with the index of template archives in tmpdir/index.json, which maps archive hashes to the files.
+// Index is locked for the time of f and saved if f returns true.
+func withCache(f func(index map[string]*cacheEntry) bool) error {
+	path := config.Agent.LxcPrefix + "tmpdir/index.json"
+	lock, err := os.OpenFile(path+".lock", os.O_RDWR|os.O_CREATE, 0600)
+	if err != nil {
+		return err
+	}
+	defer lock.Close()
+	if err = syscall.Flock(int(lock.Fd()), syscall.LOCK_EX); err != nil {
+		return err
+	}
+
+	index := make(map[string]*cacheEntry)
+	if data, err := ioutil.ReadFile(path); err == nil {
+		log.Check(log.WarnLevel, "Parsing template index", json.Unmarshal(data, &index))
+	}
+	if !f(index) {
+		return nil
+	}
+	data, err := json.Marshal(index)
+	if err != nil {
+		return err
+	}
+	if err = ioutil.WriteFile(path+".tmp", data, 0600); err != nil {
+		return err
+	}
+	return os.Rename(path+".tmp", path)
+}
+
+// CacheGet returns the name of archive file with the hash, empty string if it's not in tmpdir.
+func CacheGet(sum string) string {
+	return cacheGet(sum, false)
+}
+
+// CacheShared returns the name of archive file with the hash if it can be shared with other resource hosts,
+// empty string if it's not in tmpdir or it's not a public template downloaded from the repository.
+func CacheShared(sum string) string {
+	return cacheGet(sum, true)
+}
+
+func cacheGet(sum string, shared bool) (file string) {
+	log.Check(log.WarnLevel, "Reading template index", withCache(func(index map[string]*cacheEntry) bool {
+		e, ok := index[sum]
+		if !ok || (shared && !e.Shared) {
+			return false
+		}
+		if st, err := os.Stat(config.Agent.LxcPrefix + "tmpdir/" + e.File); err != nil || st.Size() != e.Size {
+			delete(index, sum)
+			return true
+		}
+		e.Used = time.Now().Unix()
+		file = e.File
+		return true
+	}))
+	return file
+}
+
+// CacheAdd adds verified archive of the template to the index. Least recently used archives are removed
+// if the size of indexed archives exceeds cachesize option of [cdn] section, in MB.
+// Shared archives are served to other resource hosts, it must be set only for public templates downloaded from the repository.
+func CacheAdd(path, name, sum string, shared bool) {
+	st, err := os.Stat(path)
+	if err != nil {
+		return
+	}
+	log.Check(log.WarnLevel, "Updating template index", withCache(func(index map[string]*cacheEntry) bool {
+		// the same archive found again in tmpdir stays shared
+		if e, ok := index[sum]; ok && e.Shared && e.File == st.Name() && e.Size == st.Size() {
+			shared = true
+		}
+		index[sum] = &cacheEntry{Name: name, File: st.Name(), Size: st.Size(), Used: time.Now().Unix(), Shared: shared}
+		evict(index, sum)
+		return true
+	}))
+}
+
+// CacheDel removes the archive and its index entry.
+func CacheDel(file string) {
+	log.Check(log.WarnLevel, "Updating template index", withCache(func(index map[string]*cacheEntry) bool {
+		for sum, e := range index {
+			if e.File == file {
+				delete(index, sum)
+			}
+		}
+		return true
+	}))
+	os.Remove(config.Agent.LxcPrefix + "tmpdir/" + file)
+	os.Remove(config.Agent.LxcPrefix + "tmpdir/" + file + ".digest")
+}
+
+// evict removes least recently used archives until their size fits the limit. Archive just added, archives added
+// or used within cacheGrace and archives of templates which are parents of installed containers or templates are kept.
+func evict(index map[string]*cacheEntry, keep string) {
+	limit := int64(config.CDN.Cachesize) << 20
+	var total int64
+	for _, e := range index {
+		total += e.Size
+	}
+	if limit <= 0 || total <= limit {
+		return
+	}
+
+	parents := make(map[string]bool)
+	for _, name := range container.All() {
+		if parent := container.GetConfigItem(config.Agent.LxcPrefix+name+"/config", "subutai.parent"); parent != name {
+			parents[parent] = true
+		}
+	}
+	recent := time.Now().Add(-cacheGrace).Unix()
+	var list []string
+	for sum, e := range index {
+		if sum != keep && !parents[e.Name] && e.Used < recent {
+			list = append(list, sum)
+		}
+	}
+	sort.Slice(list, func(i, j int) bool { return index[list[i]].Used < index[list[j]].Used })
+	for _, sum := range list {
+		if total <= limit {
+			return
+		}
+		e := index[sum]
+		log.Debug("Removing template archive " + e.File)
+		os.Remove(config.Agent.LxcPrefix + "tmpdir/" + e.File)
+		os.Remove(config.Agent.LxcPrefix + "tmpdir/" + e.File + ".digest")
+		total -= e.Size
+		delete(index, sum)
+	}
+}
@@ -55,6 +55,6 @@ func MngInit() {
 
 // MngDel removes Management network interfaces, resets dhcp client
 func MngDel() {
-	exec.Command("ovs-vsctl", "del-port", "wan", "management").Run()
-	exec.Command("ovs-vsctl", "del-port", "wan", "mng-gw").Run()
+	net.DelPort("wan", "management")
+	net.DelPort("wan", "mng-gw")
 }
@@ -4,32 +4,20 @@ package template
 import (
 	"crypto/rand"
 	"fmt"
+	"io"
 
 	"github.com/subutai-io/agent/config"
 	"github.com/subutai-io/agent/lib/fs"
 	"github.com/subutai-io/agent/log"
 )
 
-// Install deploys downloaded and unpacked templates to the system
-func Install(parent, child string) {
-	delta := map[string][]string{
-		child + "/deltas/rootfs.delta": {parent + "/rootfs", child},
-		child + "/deltas/home.delta":   {parent + "/home", child},
-		child + "/deltas/opt.delta":    {parent + "/opt", child},
-		child + "/deltas/var.delta":    {parent + "/var", child},
-	}
-
-	fs.SubvolumeCreate(config.Agent.LxcPrefix + child)
-
-	p := true
-	if parent == child || parent == "" {
-		p = false
-	}
-
-	for delta, path := range delta {
-		fs.Receive(config.Agent.LxcPrefix+path[0], config.Agent.LxcPrefix+path[1], delta, p)
-	}
+// Receive deploys the volume of the template from its delta. Template subvolume should be created before.
+func Receive(parent, child, vol string, delta io.Reader) error {
+	return fs.ReceiveStream(config.Agent.LxcPrefix+parent+"/"+vol, config.Agent.LxcPrefix+child, delta, parent != child && parent != "")
+}
 
+// Configure copies config files of unpacked template to the system.
+func Configure(child string) {
 	for _, file := range []string{"config", "fstab", "packages"} {
 		fs.Copy(config.Agent.LxcPrefix+"tmpdir/"+child+"/"+file, config.Agent.LxcPrefix+child+"/"+file)
 	}
@@ -232,6 +232,15 @@ func main() {
 			return nil
 		}}, {
 
+		Name: "pool", Usage: "warm pool of prepared clones",
+		Flags: []gcli.Flag{
+			gcli.StringFlag{Name: "size, s", Usage: "number of standby clones kept for template"},
+			gcli.BoolFlag{Name: "refill, r", Usage: "create missing standby clones"}},
+		Action: func(c *gcli.Context) error {
+			cli.Pool(c.Args().Get(0), c.String("s"), c.Bool("r"))
+			return nil
+		}}, {
+
 		Name: "promote", Usage: "promote Subutai container",
 		Flags: []gcli.Flag{gcli.StringFlag{Name: "source, s", Usage: "set the source for promoting"}},
 		Action: func(c *gcli.Context) error {
@@ -283,7 +292,7 @@ func main() {
 
 		Name: "quota", Usage: "set quotas for Subutai container",
 		Flags: []gcli.Flag{
-			gcli.StringFlag{Name: "set, s", Usage: "set quota for the specified resource type (cpu, cpuset, ram, disk, network)"},
+			gcli.StringFlag{Name: "set, s", Usage: "set quota for the specified resource type (cpu, cpuset, ram, disk, network, vlan)"},
 			gcli.StringFlag{Name: "threshold, t", Usage: "set alert threshold"}},
 		Action: func(c *gcli.Context) error {
 			cli.LxcQuota(c.Args().Get(0), c.Args().Get(1), c.String("s"), c.String("t"))